@@ -0,0 +1,460 @@
+// Microbenchmarks for the core data paths - the event queue, the tick set, command parsing, and fanning SAY, SHOUT and BROADCAST out to a crowd
+// The real world and shard code runs against a stub session that only counts what it's sent, so nothing touches a socket
+// Build and run with:  make bench
+//
+// Results are printed as JSON, one benchmark per line:
+//   bench_core [--baseline <previous results.json>] > results.json
+// With a baseline, each benchmark's change from it is printed alongside (on stderr, so the JSON stays clean)
+// (It checks the tick set behaves before timing it, and exits with 1 if it doesn't)
+// allocs_per_op counts every operator new made during a benchmark, so a steady-state path that doesn't allocate shows 0
+
+#include <iostream>
+#include <atomic>
+#include <new>
+#include <boost/asio.hpp>
+#include <boost/algorithm/string.hpp>
+#include <charconv>
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <optional>
+#include <queue>
+#include <random>
+#include <sstream>
+#include <thread>
+#include <unordered_set>
+#include <events.h>
+#include <tokenizer.h>
+#include <commands.h>
+#include <area_image.h>
+#include <persistence.h>
+#include <players.h>
+#include <online.h>
+#include <entities.h>
+#include <metrics.h>
+
+namespace io = boost::asio;
+
+// Every allocation made through operator new (the standard containers, make_shared, std::string) is counted here
+// (Kept out of line, so the compiler doesn't see a delete expression turn into free() and take it for a mismatch)
+static std::atomic<uint64_t> allocations{0};
+
+__attribute__((noinline)) void* operator new(size_t size) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = std::malloc(size ? size : 1)) return p;
+    throw std::bad_alloc();
+}
+
+__attribute__((noinline)) void* operator new[](size_t size) {
+    return operator new(size);
+}
+
+__attribute__((noinline)) void operator delete(void* p) noexcept {
+    std::free(p);
+}
+
+__attribute__((noinline)) void operator delete[](void* p) noexcept {
+    std::free(p);
+}
+
+__attribute__((noinline)) void operator delete(void* p, size_t /*size*/) noexcept {
+    std::free(p);
+}
+
+__attribute__((noinline)) void operator delete[](void* p, size_t /*size*/) noexcept {
+    std::free(p);
+}
+
+// What the world needs from session.h, with a session that just counts what it's sent
+using shared_buffer = std::shared_ptr<const std::string>;
+
+inline shared_buffer make_buffer(std::string message) {
+    return std::make_shared<const std::string>(std::move(message));
+}
+
+class session {
+    private:
+        uint                            id;
+        std::shared_ptr<tbdmud::player> player;
+
+    public:
+        uint64_t messages = 0;
+        uint64_t bytes    = 0;
+
+        session(uint i) : id(i) {}
+
+        void post(shared_buffer message, bool /*critical*/ = false) {
+            messages++;
+            bytes += message->size();
+        }
+
+        void post(std::string const& message) {
+            messages++;
+            bytes += message.size();
+        }
+
+        uint get_id() {
+            return id;
+        }
+
+        uint64_t get_bytes_written() {
+            return bytes;
+        }
+
+        uint64_t get_queued_messages() {
+            return 0;
+        }
+
+        uint64_t get_queued_bytes() {
+            return 0;
+        }
+
+        void set_player(std::shared_ptr<tbdmud::player> p) {
+            player = p;
+        }
+
+        std::shared_ptr<tbdmud::player> get_player() {
+            return player;
+        }
+};
+
+#include <world.h>
+
+using clock_type = std::chrono::steady_clock;
+
+// One line of results
+struct result {
+    std::string name;
+    uint64_t    param;          // The queue depth, or the number of occupants (0 if it doesn't apply)
+    uint64_t    iterations;
+    double      ns_per_op;
+    double      bytes_per_op;   // Sent to the stub sessions (0 if nothing is)
+    double      allocs_per_op;  // Calls to operator new
+};
+
+static std::vector<result> results;
+static std::ostream        out(std::cout.rdbuf());   // The world logs to std::cout, which is silenced while the benchmarks run
+static std::ostringstream  discarded;
+
+// Run op until enough time has passed to measure, returns the iterations and the time per iteration
+template<typename F>
+void run(const std::string& name, uint64_t param, F op, std::function<uint64_t()> bytes_sent = nullptr) {
+    const std::chrono::milliseconds min_time(300);
+
+    for (int i = 0; i < 10; i++) op();   // Warm up
+
+    uint64_t bytes_before  = bytes_sent ? bytes_sent() : 0;
+    uint64_t allocs_before = allocations.load();
+    uint64_t iterations    = 0;
+    uint64_t batch         = 1;
+    clock_type::time_point start = clock_type::now();
+    clock_type::time_point now;
+    do {
+        for (uint64_t i = 0; i < batch; i++) op();
+        iterations += batch;
+        if (batch < 4096) batch *= 2;
+        now = clock_type::now();
+    } while (now - start < min_time);
+
+    double ns     = std::chrono::duration<double, std::nano>(now - start).count() / iterations;
+    double bytes  = bytes_sent ? (double) (bytes_sent() - bytes_before) / iterations : 0;
+    double allocs = (double) (allocations.load() - allocs_before) / iterations;
+    discarded.str("");   // Don't let the silenced log grow between benchmarks
+    results.push_back({name, param, iterations, ns, bytes, allocs});
+    std::cerr << std::left << std::setw(28) << name << std::right << std::setw(8) << param << std::setw(14) << std::fixed
+              << std::setprecision(1) << ns << " ns/op" << std::setw(14) << bytes << " bytes/op" << std::setw(12) << std::setprecision(2)
+              << allocs << " allocs/op" << std::endl;
+}
+
+// add_event and next_event with depth events already waiting (scheduled over the next hour of ticks)
+void bench_event_queue() {
+    const uint64_t depths[] = {0, 100, 10000, 1000000};
+
+    for (uint64_t depth : depths) {
+        uint64_t                   tick = 0;
+        tbdmud::event_queue        eq(&tick);
+        std::mt19937               rng(1);
+        std::uniform_int_distribution<uint> later(1, 3600);
+
+        for (uint64_t i = 0; i < depth; i++) {
+            tbdmud::notice_event n;
+            eq.add_event(std::move(n), later(rng));
+        }
+
+        tbdmud::event e;
+        run("event_queue/add_next", depth, [&] {
+            tbdmud::notice_event n;
+            eq.add_event(std::move(n));
+            eq.next_event(e);
+        });
+
+        // Scheduling into the future and collecting as the clock turns, keeping the depth about the same
+        run("event_queue/add_delayed", depth, [&] {
+            tbdmud::notice_event n;
+            eq.add_event(std::move(n), later(rng));
+            if (depth > 0) {
+                tick += (rng() % (depth / 3600 + 1) == 0);   // Turn the clock about as fast as events are added, so the depth holds
+            }
+            while (eq.next_event(e)) {}
+        });
+    }
+}
+
+// A tick subscriber that counts its calls, and can unsubscribe someone (itself included) or subscribe someone while it's called
+struct ticker : public tbdmud::tick_subscriber {
+    uint64_t                 calls = 0;
+    tbdmud::tick_set*        set   = nullptr;
+    tbdmud::tick_subscriber* drop  = nullptr;
+    tbdmud::tick_subscriber* add   = nullptr;
+
+    void on_tick(uint64_t /*tick*/) override {
+        calls++;
+        if (drop != nullptr) set->unsubscribe(drop);
+        if (add != nullptr) set->subscribe(add);
+    }
+};
+
+// Check the tick set does what the zones rely on, returns false (having said why) if it doesn't
+bool check_tick_set() {
+    auto fail = [] (const char* why) {
+        std::cerr << "bench_core:  tick_set " << why << std::endl;
+        return false;
+    };
+
+    tbdmud::tick_set set;
+    ticker a, b, c, d;
+    set.subscribe(&a);
+    set.subscribe(&b);
+    set.subscribe(&c);
+    set.subscribe(&a);
+    set.run(1);
+    if ((set.size() != 3) || (a.calls != 1) || (b.calls != 1) || (c.calls != 1)) return fail("didn't call each subscriber once");
+
+    // Unsubscribing during run() leaves a hole (whoever is dropped later in the walk isn't called), and it's compacted afterwards
+    // Subscribing during run() waits for the next tick
+    a.set = &set;
+    a.drop = &c;
+    b.set = &set;
+    b.drop = &b;
+    b.add  = &d;
+    set.run(2);
+    if ((a.calls != 2) || (b.calls != 2) || (c.calls != 1) || (d.calls != 0)) return fail("called the wrong subscribers while they changed");
+    if ((set.size() != 2) || b.is_ticking() || c.is_ticking() || !d.is_ticking()) return fail("wasn't compacted after run()");
+    a.drop = nullptr;
+    set.run(3);
+    if ((a.calls != 3) || (d.calls != 1)) return fail("lost a subscriber in compaction");
+    if (!set.unsubscribe(&d) || set.unsubscribe(&d) || !set.unsubscribe(&a) || (set.size() != 0)) return fail("kept the wrong slots after compaction");
+
+    // Subscribing to another set moves it, and a subscriber unsubscribes itself when it goes
+    tbdmud::tick_set other;
+    set.subscribe(&a);
+    other.subscribe(&a);
+    if ((set.size() != 0) || (other.size() != 1)) return fail("didn't move a subscriber between sets");
+    {
+        ticker gone;
+        other.subscribe(&gone);
+    }
+    other.run(4);
+    if ((other.size() != 1) || (a.calls != 4)) return fail("kept a subscriber after it was destroyed");
+
+    // A set that goes first lets its subscribers know
+    {
+        tbdmud::tick_set brief;
+        brief.subscribe(&c);
+    }
+    if (c.is_ticking()) return fail("left a subscriber pointing at a destroyed set");
+
+    // A character ticking in one zone ticks in the next one they enter
+    std::shared_ptr<tbdmud::event_queue> eq;
+    tbdmud::zone from("from", eq), to("to", eq);
+    std::shared_ptr<tbdmud::character> walker(new tbdmud::character("walker"));
+    from.enter_zone(walker);
+    from.get_ticking().subscribe(walker.get());
+    from.leave_zone(walker);
+    to.enter_zone(walker);
+    if ((from.get_ticking().size() != 0) || (to.get_ticking().size() != 1)) return fail("didn't carry a character's ticks to the next zone");
+    to.leave_zone(walker);
+
+    return true;
+}
+
+// A tick costs the number of subscribers, however many entities there are
+void bench_tick_set() {
+    const uint64_t subscribers[] = {0, 10, 1000, 100000};
+
+    for (uint64_t n : subscribers) {
+        tbdmud::tick_set    set;
+        std::vector<ticker> tickers(n);
+        for (ticker& t : tickers) set.subscribe(&t);
+
+        uint64_t tick = 0;
+        run("tick_set/run", n, [&] {
+            set.run(++tick);
+        });
+
+        // One subscriber dropping out and another joining on each tick, the way things come and go in a busy zone
+        if (n == 0) continue;
+        ticker spare;
+        tickers[0].set = &set;
+        run("tick_set/churn", n, [&] {
+            tickers[0].drop = spare.is_ticking() ? (tbdmud::tick_subscriber*) &spare : &tickers[n - 1];
+            tickers[0].add  = spare.is_ticking() ? (tbdmud::tick_subscriber*) &tickers[n - 1] : &spare;
+            set.run(++tick);
+        });
+    }
+}
+
+// The whole server-side path for a line typed by a player:  the world routes it, the shard parses and dispatches it,
+// and the events it queues are handled (the stub counts the replies)
+void bench_command_parse(io::io_context& io_context, tbdmud::world& w, std::shared_ptr<session> alice) {
+    const std::pair<const char*, const char*> lines[] = {
+        {"command_parse/look",       "look\r\n"},
+        {"command_parse/say",        "say hello there everyone\r\n"},
+        {"command_parse/tell",       "tell bob meet me at the north gate\r\n"},
+        {"command_parse/move",       "n;s\r\n"},
+        {"command_parse/abbreviated", "sa hi\r\n"},
+        {"command_parse/unknown",    "xyzzy\r\n"},
+        {"command_parse/chained",    "say one;say two;look;tell bob three\r\n"},
+    };
+
+    for (const std::pair<const char*, const char*>& l : lines) {
+        std::string line = l.second;
+        run(l.first, 0, [&] {
+            w.command_parse(alice, line);
+            io_context.poll();
+            io_context.restart();
+        }, [&] { return alice->bytes; });
+    }
+}
+
+int main(int argc, char* argv[]) {
+    std::string baseline;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if ((arg == "--baseline") && (i + 1 < argc)) {
+            baseline = argv[++i];
+        }
+        else {
+            std::cerr << "Usage:  bench_core [--baseline <previous results.json>]" << std::endl;
+            return 2;
+        }
+    }
+
+    // The world runs on an io_context that's only polled from here, so everything happens on this thread
+    io::io_context io_context;
+    world_strand   strand(io_context.get_executor());
+
+    std::cout.rdbuf(discarded.rdbuf());
+
+    char data_dir[] = "/tmp/bench_core.XXXXXX";
+    if (mkdtemp(data_dir) == nullptr) return 1;
+
+    tbdmud::world w(strand);
+    if (!w.load_areas("areas/world.img") || !w.open_store(data_dir)) {
+        std::cerr << "bench_core:  can't set up the world (run it from the top directory, after make areas)" << std::endl;
+        return 1;
+    }
+
+    if (!check_tick_set()) return 1;
+
+    bench_event_queue();
+    bench_tick_set();
+
+    // Everyone stands in the start room of the start zone
+    uint next_id = 1;
+    std::vector<std::shared_ptr<session>> crowd;
+    auto log_in = [&] (const std::string& name) {
+        std::shared_ptr<session> s = std::make_shared<session>(next_id++);
+        s->set_player(std::shared_ptr<tbdmud::player>(new tbdmud::player(name, s->get_id(), true, "127.0.0.1", 0)));
+        tbdmud::player_account account;
+        account.name = name;
+        w.create_character(s, account);
+        io_context.poll();
+        io_context.restart();
+        crowd.push_back(s);
+        return s;
+    };
+
+    std::shared_ptr<session> alice = log_in("alice");
+    log_in("bob");
+    bench_command_parse(io_context, w, alice);
+
+    // Fan-out - the event is handed straight to the shard (SAY, SHOUT) or the world (BROADCAST), so this is just delivering it
+    tbdmud::shard* home = w.find_shard(tbdmud::symbols().find("Zion"));
+    auto total_bytes = [&] {
+        uint64_t b = 0;
+        for (std::shared_ptr<session>& s : crowd) b += s->bytes;
+        return b;
+    };
+
+    const uint64_t occupants[] = {10, 100, 1000, 10000};
+    for (uint64_t n : occupants) {
+        while (crowd.size() < n) log_in("guest" + std::to_string(crowd.size()));
+
+        tbdmud::symbol speaker = alice->get_player()->get_character()->get_id();
+        const std::pair<const char*, tbdmud::event_scope> kinds[] = {
+            {"fanout/say",       tbdmud::ROOM},
+            {"fanout/shout",     tbdmud::ZONE},
+            {"fanout/broadcast", tbdmud::WORLD},
+        };
+
+        for (const std::pair<const char*, tbdmud::event_scope>& k : kinds) {
+            run(k.first, n, [&] {
+                tbdmud::speak_event speak;
+                speak.scope   = k.second;
+                speak.origin  = speaker;
+                speak.message = home->get_pool().make_text("hello there everyone");
+                tbdmud::event e = std::move(speak);
+                if (k.second == tbdmud::WORLD) w.process_event(e);
+                else home->process_event(e);
+            }, total_bytes);
+        }
+    }
+
+    w.save_to_disk();
+    std::cout.rdbuf(out.rdbuf());
+    std::filesystem::remove_all(data_dir);
+
+    // Read the baseline's ns_per_op by name and parameter (it's the format written below, one benchmark per line)
+    std::map<std::pair<std::string, uint64_t>, double> previous;
+    if (!baseline.empty()) {
+        std::ifstream in(baseline);
+        std::string   text;
+        while (std::getline(in, text)) {
+            size_t n = text.find("\"name\": \"");
+            size_t p = text.find("\"param\": ");
+            size_t t = text.find("\"ns_per_op\": ");
+            if ((n == std::string::npos) || (p == std::string::npos) || (t == std::string::npos)) continue;
+
+            n += 9;
+            std::string name = text.substr(n, text.find('"', n) - n);
+            previous[{name, std::stoull(text.substr(p + 9))}] = std::stod(text.substr(t + 13));
+        }
+        if (previous.empty()) std::cerr << "bench_core:  no results in " << baseline << std::endl;
+    }
+
+    out << "{\n  \"benchmarks\": [\n";
+    for (size_t i = 0; i < results.size(); i++) {
+        result& r = results[i];
+        out << "    {\"name\": \"" << r.name << "\", \"param\": " << r.param << ", \"iterations\": " << r.iterations
+            << ", \"ns_per_op\": " << std::fixed << std::setprecision(1) << r.ns_per_op << ", \"bytes_per_op\": " << r.bytes_per_op << ", \"allocs_per_op\": " << std::setprecision(2) << r.allocs_per_op << "}"
+            << ((i + 1 < results.size()) ? "," : "") << "\n";
+    }
+    out << "  ]\n}" << std::endl;
+
+    if (!previous.empty()) {
+        std::cerr << std::endl << "Against " << baseline << ":" << std::endl;
+        for (result& r : results) {
+            std::map<std::pair<std::string, uint64_t>, double>::iterator p = previous.find({r.name, r.param});
+            if (p == previous.end()) continue;
+            std::cerr << std::left << std::setw(28) << r.name << std::right << std::setw(8) << r.param << std::setw(14) << std::fixed
+                      << std::setprecision(1) << p->second << " -> " << r.ns_per_op << " ns/op  (" << std::showpos
+                      << (r.ns_per_op / p->second - 1) * 100 << "%)" << std::noshowpos << std::endl;
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,130 @@
+// Measures the per-command cost of splitting player input into commands and words
+// Compares the string_view tokenizer against the old split/substr parsing it replaced, for a single command and for long ;-chained lines
+// Build and run with:  make bench
+
+#include <iostream>
+#include <chrono>
+#include <cstdlib>
+#include <new>
+#include <string>
+#include <vector>
+#include <boost/algorithm/string.hpp>
+#include <tokenizer.h>
+
+// Count every heap allocation, so we can show how many each way of parsing makes per command
+static uint64_t allocations = 0;
+
+void* operator new(std::size_t size) {
+    allocations++;
+    if (void* p = std::malloc(size)) return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept {
+    std::free(p);
+}
+
+static size_t sink = 0;  // Everything parsed is added into this, so the compiler can't throw the work away
+
+// How command_parse used to split a line
+void parse_split(std::string line) {
+    std::vector<std::string> commands;
+
+    line.pop_back();  // Remove the LF that comes with the line
+    line.pop_back();  // Remove the CR that comes with the line
+    boost::split(commands, line, boost::is_any_of(";"), boost::token_compress_on);
+
+    for (std::string c : commands) {
+        std::vector<std::string> v_command;
+        std::size_t c_position;
+        std::string message = c;
+
+        size_t space = message.find(" ");
+        if (space != std::string::npos) {
+            message = message.substr(space + 1);
+        }
+
+        while ((c_position = c.find(' ')) != std::string::npos) {
+            v_command.push_back(c.substr(0, c_position));
+            c = c.substr(c_position + 1);
+        }
+        v_command.push_back(c);
+
+        sink += v_command.size() + message.size();
+    }
+}
+
+// How command_parse splits a line now
+void parse_tokenizer(const std::string& line) {
+    tbdmud::command_tokenizer commands(line);
+    tbdmud::command cmd;
+
+    while (commands.next(cmd)) {
+        sink += cmd.size() + cmd.rest().size();
+    }
+}
+
+// Run one way of parsing over the line until enough time has passed to measure, and print the cost per command
+template<typename F>
+void run(const char* name, const char* parser, const std::string& line, size_t commands_per_line, F parse) {
+    using clock = std::chrono::steady_clock;
+    const std::chrono::milliseconds min_time(200);
+
+    // Warm up, then count the allocations made by a single line
+    parse(line);
+    uint64_t before = allocations;
+    parse(line);
+    uint64_t allocs = allocations - before;
+
+    uint64_t iterations = 0;
+    clock::time_point start = clock::now();
+    clock::time_point now;
+    do {
+        for (int i = 0; i < 100; i++) parse(line);
+        iterations += 100;
+        now = clock::now();
+    } while (now - start < min_time);
+
+    double ns = std::chrono::duration<double, std::nano>(now - start).count() / (iterations * commands_per_line);
+    std::cout << name << "  " << parser << ":  " << ns << " ns/command, "
+              << (double) allocs / commands_per_line << " allocs/command" << std::endl;
+}
+
+// A line of n commands chained with ;
+std::string chained(size_t n) {
+    const char* pattern[] = {"n", "say hello there everyone", "look", "tell bob meet me at the north gate", "s"};
+    std::string line;
+
+    for (size_t i = 0; i < n; i++) {
+        if (i > 0) line += ";";
+        line += pattern[i % 5];
+    }
+
+    return line + "\r\n";
+}
+
+int main() {
+    struct test_line {
+        const char* name;
+        std::string line;
+        size_t      commands;
+    };
+
+    std::vector<test_line> lines = {
+        {"single command    ", "say hello there everyone\r\n", 1},
+        {"10 chained        ", chained(10),                    10},
+        {"100 chained       ", chained(100),                   100},
+        {"1000 chained      ", chained(1000),                  1000},
+    };
+
+    for (test_line& t : lines) {
+        run(t.name, "split    ", t.line, t.commands, parse_split);
+        run(t.name, "tokenizer", t.line, t.commands, parse_tokenizer);
+    }
+
+    return (sink == 0);  // Never true, but keeps the parsed results alive
+}
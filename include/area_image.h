@@ -0,0 +1,184 @@
+// This file contains the layout of the compiled area image, and the read-only view the server maps it in with
+// Area files (areas/*.are) are compiled offline by tools/areac.cpp into one image - a zone table, a room table, an exit table
+// and a string pool - so loading the world is just mapping the file and walking the tables, with nothing to parse
+
+#ifndef TBDMUD_AREA_IMAGE_H_INCLUDED
+#define TBDMUD_AREA_IMAGE_H_INCLUDED
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace tbdmud {
+
+const char     AREA_IMAGE_MAGIC[8]   = {'T', 'B', 'D', 'A', 'R', 'E', 'A', '\0'};
+const uint32_t AREA_IMAGE_VERSION    = 1;
+
+// Every table entry is fixed size and 4-byte aligned, and every reference is an index, so the image can be used where it's mapped
+// (It's written in the byte order of the machine that compiled it)
+
+// A string in the pool
+struct area_string {
+    uint32_t offset;
+    uint32_t length;
+};
+
+struct area_header {
+    char     magic[8];
+    uint32_t version;
+    uint32_t num_zones;
+    uint32_t num_rooms;
+    uint32_t num_exits;
+    uint32_t zones_offset;      // Byte offsets of the tables from the start of the image
+    uint32_t rooms_offset;
+    uint32_t exits_offset;
+    uint32_t strings_offset;
+    uint32_t strings_size;
+};
+
+// The first zone in the table is where new characters start
+struct area_zone {
+    area_string name;
+    uint32_t    start_room;     // Index into the room table
+    uint32_t    first_room;     // A zone's rooms are contiguous in the room table
+    uint32_t    num_rooms;
+};
+
+struct area_room {
+    area_string name;
+    uint32_t    zone;           // Index into the zone table
+    uint32_t    first_exit;     // A room's exits are contiguous in the exit table
+    uint32_t    num_exits;
+};
+
+struct area_exit {
+    area_string name;
+    uint32_t    target_room;    // Index into the room table (it may be in another zone)
+};
+
+// A compiled image mapped read-only into memory
+// The pages are shared with the page cache (and with any other process mapping the same image) rather than copied
+class area_image {
+    private:
+        const char*         data = nullptr;
+        size_t              size = 0;
+        const area_header*  header = nullptr;
+        std::string         error;
+
+        // Check that a table of count entries of T at offset lies inside the image
+        template<typename T>
+        bool table_fits(uint32_t offset, uint32_t count) {
+            return (offset % alignof(T) == 0) && ((uint64_t) offset + (uint64_t) count * sizeof(T) <= size);
+        }
+
+    public:
+        area_image() {}
+
+        area_image(const area_image&) = delete;
+        area_image& operator= (const area_image&) = delete;
+
+        ~area_image() {
+            close();
+        }
+
+        // Map the image and check its header and table bounds, returns false (with get_error() saying why) if it can't be used
+        bool open(const std::string& path) {
+            close();
+
+            int fd = ::open(path.c_str(), O_RDONLY);
+            if (fd < 0) {
+                error = "can't open " + path + ":  " + std::strerror(errno);
+                return false;
+            }
+
+            struct stat st;
+            if ((fstat(fd, &st) != 0) || (st.st_size < (off_t) sizeof(area_header))) {
+                error = path + " is too small to be an area image";
+                ::close(fd);
+                return false;
+            }
+
+            void* m = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+            ::close(fd);  // The mapping keeps the file open
+            if (m == MAP_FAILED) {
+                error = "can't map " + path + ":  " + std::strerror(errno);
+                return false;
+            }
+
+            data   = static_cast<const char*>(m);
+            size   = st.st_size;
+            header = reinterpret_cast<const area_header*>(data);
+
+            if ((std::memcmp(header->magic, AREA_IMAGE_MAGIC, sizeof(AREA_IMAGE_MAGIC)) != 0) || (header->version != AREA_IMAGE_VERSION)) {
+                error = path + " isn't a version " + std::to_string(AREA_IMAGE_VERSION) + " area image";
+                close();
+                return false;
+            }
+
+            if (!table_fits<area_zone>(header->zones_offset, header->num_zones) ||
+                !table_fits<area_room>(header->rooms_offset, header->num_rooms) ||
+                !table_fits<area_exit>(header->exits_offset, header->num_exits) ||
+                !table_fits<char>(header->strings_offset, header->strings_size) ||
+                (header->num_zones == 0)) {
+                error = path + " is truncated or corrupt";
+                close();
+                return false;
+            }
+
+            return true;
+        }
+
+        void close() {
+            if (data != nullptr) munmap(const_cast<char*>(data), size);
+            data   = nullptr;
+            size   = 0;
+            header = nullptr;
+        }
+
+        const std::string& get_error() {
+            return error;
+        }
+
+        size_t get_size() {
+            return size;
+        }
+
+        uint32_t num_zones() {
+            return header->num_zones;
+        }
+
+        uint32_t num_rooms() {
+            return header->num_rooms;
+        }
+
+        uint32_t num_exits() {
+            return header->num_exits;
+        }
+
+        const area_zone& zone(uint32_t i) {
+            return reinterpret_cast<const area_zone*>(data + header->zones_offset)[i];
+        }
+
+        const area_room& room(uint32_t i) {
+            return reinterpret_cast<const area_room*>(data + header->rooms_offset)[i];
+        }
+
+        const area_exit& exit(uint32_t i) {
+            return reinterpret_cast<const area_exit*>(data + header->exits_offset)[i];
+        }
+
+        // A view of a string in the pool ("" if it doesn't lie inside the pool)
+        std::string_view str(const area_string& s) {
+            if ((uint64_t) s.offset + s.length > header->strings_size) return std::string_view();
+            return std::string_view(data + header->strings_offset + s.offset, s.length);
+        }
+};
+
+}  // end namespace tbdmud
+
+#endif
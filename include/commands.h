@@ -0,0 +1,149 @@
+// This file contains the command registry - the index the command parser looks the first word of each command up in
+// Commands and exits register their names once at startup, and a lookup walks a case-insensitive trie one letter at a time,
+// so it costs the length of the word no matter how many commands there are, and any unique prefix works as an abbreviation
+
+#ifndef TBDMUD_COMMANDS_H_INCLUDED
+#define TBDMUD_COMMANDS_H_INCLUDED
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <symbols.h>
+
+namespace tbdmud {
+
+// When two names share a prefix, the one with the higher priority gets the abbreviation (movement beats the other commands,
+// so "s" is south rather than say or shout), and if they're tied the prefix is ambiguous
+enum command_priority {
+    COMMAND_PRIORITY = 0,
+    EXIT_PRIORITY    = 1
+};
+
+// T is whatever the owner wants back for a command (a handler)
+template<typename T>
+class command_registry {
+    public:
+        struct entry {
+            std::string name;       // As it was registered (exits keep their case, that's how they're shown)
+            symbol      id;         // The name interned, so a handler can tell which name it was registered under
+            T           handler;
+            int         priority;
+        };
+
+        // What a lookup found - match is nullptr if nothing matched, or if more than one thing did (ambiguous)
+        struct result {
+            const entry* match     = nullptr;
+            bool         ambiguous = false;
+        };
+
+    private:
+        static const int NONE = -1;
+
+        // One letter of a name - the case-folded ASCII characters index straight into the children
+        struct node {
+            std::array<uint16_t, 128> children = {};    // 0 = no child (the root is never anyone's child)
+            int  exact     = NONE;                       // The entry whose whole name ends here
+            int  best      = NONE;                       // The entry an abbreviation ending here means
+            int  best_priority = 0;
+            bool tied      = false;                      // Two entries with the best priority share this prefix
+        };
+
+        std::vector<entry> entries;
+        std::vector<node>  nodes{1};                    // nodes[0] is the root
+
+        static int fold(char c) {
+            unsigned char u = c;
+            if (u >= 128) return NONE;
+            return ((u >= 'A') && (u <= 'Z')) ? (u - 'A' + 'a') : u;
+        }
+
+    public:
+        // Register a name, returns false if it (or a case-insensitive version of it) is already registered
+        // This isn't locked, so register everything before the shards start looking names up
+        bool add(std::string_view name, T handler, int priority = COMMAND_PRIORITY) {
+            if (name.empty() || (find_exact(name) != NONE)) return false;
+
+            int id = entries.size();
+            entries.push_back({std::string(name), symbols().intern(name), handler, priority});
+
+            uint n = 0;
+            for (char c : name) {
+                int f = fold(c);
+                if (f == NONE) {
+                    entries.pop_back();
+                    return false;
+                }
+
+                if (nodes[n].children[f] == 0) {
+                    nodes[n].children[f] = nodes.size();
+                    nodes.emplace_back();
+                }
+                n = nodes[n].children[f];
+
+                // Every prefix along the way is a possible abbreviation for this name
+                node& p = nodes[n];
+                if ((p.best == NONE) || (priority > p.best_priority)) {
+                    p.best = id;
+                    p.best_priority = priority;
+                    p.tied = false;
+                }
+                else if (priority == p.best_priority) {
+                    p.tied = true;
+                }
+            }
+            nodes[n].exact = id;
+
+            return true;
+        }
+
+        // Look a typed word up - a whole name always wins, otherwise it's the abbreviation of the one name it's a prefix of
+        result find(std::string_view word) const {
+            result r;
+            uint n = walk(word);
+
+            if (n == 0) return r;
+
+            const node& p = nodes[n];
+            if (p.exact != NONE) {
+                r.match = &entries[p.exact];
+            }
+            else if (p.tied) {
+                r.ambiguous = true;
+            }
+            else if (p.best != NONE) {
+                r.match = &entries[p.best];
+            }
+
+            return r;
+        }
+
+        size_t size() const {
+            return entries.size();
+        }
+
+    private:
+        // Follow the word down the trie, returns the node it ends on (0 if it falls off)
+        uint walk(std::string_view word) const {
+            uint n = 0;
+
+            for (char c : word) {
+                int f = fold(c);
+                if (f == NONE) return 0;
+                n = nodes[n].children[f];
+                if (n == 0) return 0;
+            }
+
+            return n;
+        }
+
+        int find_exact(std::string_view name) const {
+            uint n = walk(name);
+            return (n != 0) ? nodes[n].exact : NONE;
+        }
+};
+
+}  // end namespace tbdmud
+
+#endif
@@ -0,0 +1,205 @@
+// This file contains the copyover handoff - what a running server passes to the binary it re-executes, so that nobody's connection
+// is dropped when the server is upgraded
+// The sockets themselves are inherited across the exec, the handoff file says whose each one is and what was still waiting to be sent to it
+
+#ifndef TBDMUD_COPYOVER_H_INCLUDED
+#define TBDMUD_COPYOVER_H_INCLUDED
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <unordered_set>
+#include <vector>
+#include <players.h>
+
+namespace tbdmud {
+
+// The new binary finds the listening socket and the handoff file through this environment variable (so the command line stays the same
+// across the exec) - it's "<listener fd> <handoff file>", so the listener can be found even if the file can't be read
+const char* const COPYOVER_ENV = "TBDMUD_COPYOVER";
+
+// One connection, as it was handed over
+struct copyover_session {
+    int              fd = -1;
+    uint32_t         id = 0;
+    std::string      ip;
+    uint32_t         port = 0;
+    bool             logged_in = false;     // If not, they're asked for their username again
+    player_account   account;               // With the zone and room they were standing in (if they're logged in)
+    uint16_t         width = 0;             // What the client told us through telnet negotiation
+    uint16_t         height = 0;
+    std::string      terminal_type;
+    bool             compressed = false;    // They had MCCP2 on - their stream was finished, and the new binary starts it again
+    std::string      pending;               // Output that hadn't been written to them yet, as it goes on the wire
+    std::string      input;                 // What they'd typed that hadn't been handled yet
+};
+
+struct copyover_state {
+    int                            listener = -1;       // The listening socket, so connections that arrive during the exec wait in its backlog
+    uint32_t                       session_counter = 0;
+    std::vector<copyover_session>  sessions;
+};
+
+class copyover_file {
+    private:
+        static const uint64_t MAGIC    = 0x32564f4350444254ull;   // "TBDPCOV2"
+        static const uint64_t MAGIC_V1 = 0x31564f4350444254ull;   // "TBDPCOV1" - written by servers that didn't hand over typed input
+
+        template<typename T>
+        static void put(std::string& out, T v) {
+            out.append(reinterpret_cast<const char*>(&v), sizeof(v));
+        }
+
+        static void put_str(std::string& out, const std::string& s) {
+            put(out, (uint32_t) s.size());
+            out += s;
+        }
+
+        template<typename T>
+        static bool get(const std::string& in, size_t& p, T& v) {
+            if (p + sizeof(T) > in.size()) return false;
+            std::memcpy(&v, in.data() + p, sizeof(T));
+            p += sizeof(T);
+            return true;
+        }
+
+        static bool get_str(const std::string& in, size_t& p, std::string& s) {
+            uint32_t n;
+            if (!get(in, p, n) || (p + n > in.size())) return false;
+            s.assign(in.data() + p, n);
+            p += n;
+            return true;
+        }
+
+    public:
+        static bool write(const std::string& path, const copyover_state& state) {
+            std::string out;
+            put(out, MAGIC);
+            put(out, (int32_t) state.listener);
+            put(out, state.session_counter);
+            put(out, (uint32_t) state.sessions.size());
+
+            for (const copyover_session& s : state.sessions) {
+                put(out, (int32_t) s.fd);
+                put(out, s.id);
+                put_str(out, s.ip);
+                put(out, s.port);
+                put(out, (uint8_t) s.logged_in);
+                put_str(out, s.account.name);
+                put_str(out, s.account.zone);
+                put_str(out, s.account.room);
+                put(out, s.account.created);
+                put(out, s.account.last_login);
+                put(out, s.account.logins);
+                put(out, s.width);
+                put(out, s.height);
+                put_str(out, s.terminal_type);
+                put(out, (uint8_t) s.compressed);
+                put_str(out, s.pending);
+                put_str(out, s.input);
+            }
+
+            std::ofstream file(path, std::ios::binary | std::ios::trunc);
+            file.write(out.data(), out.size());
+            return (bool) file;
+        }
+
+        static bool read(const std::string& path, copyover_state& state) {
+            std::ifstream file(path, std::ios::binary);
+            std::string   in((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+            size_t        p = 0;
+            uint64_t      magic;
+            int32_t       listener;
+            uint32_t      count;
+
+            if (!get(in, p, magic) || ((magic != MAGIC) && (magic != MAGIC_V1)) || !get(in, p, listener) || !get(in, p, state.session_counter) || !get(in, p, count)) return false;
+            state.listener = listener;
+
+            for (uint32_t i = 0; i < count; i++) {
+                copyover_session s;
+                int32_t          fd;
+                uint8_t          logged_in, compressed;
+
+                if (!get(in, p, fd) || !get(in, p, s.id) || !get_str(in, p, s.ip) || !get(in, p, s.port) || !get(in, p, logged_in) ||
+                    !get_str(in, p, s.account.name) || !get_str(in, p, s.account.zone) || !get_str(in, p, s.account.room) ||
+                    !get(in, p, s.account.created) || !get(in, p, s.account.last_login) || !get(in, p, s.account.logins) ||
+                    !get(in, p, s.width) || !get(in, p, s.height) || !get_str(in, p, s.terminal_type) || !get(in, p, compressed) ||
+                    !get_str(in, p, s.pending) || ((magic == MAGIC) && !get_str(in, p, s.input))) {
+                    return false;
+                }
+
+                s.fd         = fd;
+                s.logged_in  = logged_in;
+                s.compressed = compressed;
+                state.sessions.push_back(std::move(s));
+            }
+
+            return true;
+        }
+};
+
+// The value of COPYOVER_ENV for a handoff
+inline std::string copyover_env(int listener, const std::string& path) {
+    return std::to_string(listener) + " " + path;
+}
+
+// Split COPYOVER_ENV back up - listener is -1 if it's just a path (as a server from before the listener was added to it sets it)
+inline void parse_copyover_env(const std::string& value, int& listener, std::string& path) {
+    size_t space = value.find(' ');
+    listener = -1;
+    path     = value;
+    if ((space == std::string::npos) || (space == 0) || (value.find_first_not_of("0123456789") != space)) return;
+
+    listener = std::atoi(value.c_str());
+    path     = value.substr(space + 1);
+}
+
+// Calls f with every open descriptor above stderr
+template<typename F>
+void for_each_open_fd(F f) {
+    DIR* fds = opendir("/proc/self/fd");
+    if (fds == nullptr) return;
+    int own = dirfd(fds);
+
+    struct dirent* entry;
+    while ((entry = readdir(fds)) != nullptr) {
+        if (entry->d_name[0] == '.') continue;
+        int fd = std::atoi(entry->d_name);
+        if ((fd > 2) && (fd != own)) f(fd);
+    }
+    closedir(fds);
+}
+
+// Make sure the handed-over sockets survive the exec and nothing else does (the metrics port, the store's files, ...)
+inline void prepare_copyover_exec(const copyover_state& state) {
+    std::unordered_set<int> keep;
+    if (state.listener >= 0) keep.insert(state.listener);
+    for (const copyover_session& s : state.sessions) keep.insert(s.fd);
+
+    for_each_open_fd([&keep] (int fd) {
+        int flags = fcntl(fd, F_GETFD);
+        if (flags < 0) return;
+        fcntl(fd, F_SETFD, (keep.count(fd) > 0) ? (flags & ~FD_CLOEXEC) : (flags | FD_CLOEXEC));
+    });
+}
+
+// The handoff file couldn't be read, so there's no telling whose the inherited sockets are - close them all (they're the only
+// descriptors that survived the exec), except the listener
+// (Call this before anything else is opened)
+inline void close_inherited_fds(int listener) {
+    std::vector<int> inherited;
+    for_each_open_fd([&inherited, listener] (int fd) {
+        if (fd != listener) inherited.push_back(fd);
+    });
+    for (int fd : inherited) ::close(fd);
+}
+
+}  // end namespace tbdmud
+
+#endif
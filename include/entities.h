@@ -6,42 +6,160 @@
 
 #include <optional>
 #include <map>
+#include <unordered_map>
 #include <events.h>
+#include <symbols.h>
 
 namespace tbdmud {
 
+// The containers a character can occupy - each one keeps track of the character's position in it
+enum occupancy {
+    ROOM_SLOT,        // The room the character is standing in
+    ZONE_SLOT,        // The zone the character is in
+    NUM_SLOTS
+};
+
+class tick_set;
+
+// Anything that wants to be called every tick subscribes to its zone's tick set - nothing is ticked just for existing
+// (Unsubscribe when there's nothing left to do, a subscriber costs a call every tick)
+class tick_subscriber {
+    private:
+        friend class tick_set;
+        tick_set* ticking = nullptr;   // The set it's subscribed to
+        size_t    tick_slot = 0;       // Its index in that set (maintained by tick_set)
+
+    public:
+        tick_subscriber() {}
+
+        // A copy isn't subscribed to anything
+        tick_subscriber(const tick_subscriber&) {}
+        tick_subscriber& operator= (const tick_subscriber&) { return *this; }
+
+        virtual ~tick_subscriber();
+
+        bool is_ticking() const {
+            return ticking != nullptr;
+        }
+
+        virtual void on_tick(uint64_t tick) = 0;
+};
+
+// A flat list of the subscribers in a zone, so a tick costs the number of subscribers rather than the size of the zone
+// Only used on the strand of the zone's shard
+class tick_set {
+    private:
+        std::vector<tick_subscriber*> members;
+        bool                          running = false;
+        bool                          holes   = false;    // Someone unsubscribed during run(), compact when it's done
+
+    public:
+        tick_set() {}
+
+        tick_set(const tick_set&) = delete;
+        tick_set& operator= (const tick_set&) = delete;
+
+        ~tick_set() {
+            for (tick_subscriber* t : members) {
+                if (t != nullptr) t->ticking = nullptr;
+            }
+        }
+
+        // Start calling t every tick (from the next one, if this one is running)
+        void subscribe(tick_subscriber* t) {
+            if (t->ticking == this) return;
+            if (t->ticking != nullptr) t->ticking->unsubscribe(t);
+
+            t->ticking   = this;
+            t->tick_slot = members.size();
+            members.push_back(t);
+        }
+
+        // Returns false if t wasn't subscribed to this set
+        bool unsubscribe(tick_subscriber* t) {
+            if (t->ticking != this) return false;
+            size_t i = t->tick_slot;
+            t->ticking = nullptr;
+
+            // Don't move anyone while the set is being walked, just leave a hole
+            if (running) {
+                members[i] = nullptr;
+                holes = true;
+                return true;
+            }
+
+            if (i != members.size() - 1) {
+                members[i] = members.back();
+                members[i]->tick_slot = i;
+            }
+            members.pop_back();
+            return true;
+        }
+
+        // Call every subscriber (the ones subscribed while this runs wait for the next tick)
+        void run(uint64_t tick) {
+            running = true;
+            size_t n = members.size();
+            for (size_t i = 0; i < n; i++) {
+                if (members[i] != nullptr) members[i]->on_tick(tick);
+            }
+            running = false;
+
+            if (holes) {
+                size_t kept = 0;
+                for (tick_subscriber* t : members) {
+                    if (t == nullptr) continue;
+                    t->tick_slot = kept;
+                    members[kept++] = t;
+                }
+                members.resize(kept);
+                holes = false;
+            }
+        }
+
+        size_t size() const {
+            return members.size();
+        }
+};
+
+inline tick_subscriber::~tick_subscriber() {
+    if (ticking != nullptr) ticking->unsubscribe(this);
+}
+
 // This class holds data about the character currently being used by a player in the world
 // (The character is created by the World object and then registered with the player
-class character {
+class character : public tick_subscriber {
     private:
-        std::string                   name;
+        symbol                        name;
+        size_t slots[NUM_SLOTS] = {};  // The character's index in each container it occupies (maintained by occupant_list)
         std::shared_ptr<event_queue>  eq;
-        std::string zone;  // The current zone that the player is in
-        std::string room;  // The current room that the player is in
+        symbol zone = NO_SYMBOL;  // The current zone that the player is in
+        symbol room = NO_SYMBOL;  // The current room that the player is in
+        bool   ticks_on_arrival = false;  // They were ticking in the zone they left, so the next zone subscribes them again
 
     public:
         // Default Constructor
         character() {
-            name = "guest";
+            name = symbols().intern("guest");
         };
 
         // Constructor - Pass in the character's name
         character(std::string n) {
-            name = n;
+            name = symbols().intern(n);
             std::cout << "Character " << n << " created" << std::endl;
         };
 
         // Constructor - Pass in the character's name and a pointer to the event queue
         character(std::string n, std::shared_ptr<event_queue> e) {
             eq = e;
-            name = n;
+            name = symbols().intern(n);
             std::cout << "Character " << n << " created" << std::endl;
         };
 
         void register_event_queue(std::shared_ptr<event_queue> e) {
             eq = e;
             #ifdef DEBUG
-            std::cout << "Character " << name << " " << "event queue registered" << std::endl;
+            std::cout << "Character " << get_name() << " " << "event queue registered" << std::endl;
             #endif
         }
 
@@ -50,36 +168,101 @@ class character {
         }
 
         void set_name(std::string n) {
-            name = n;
+            name = symbols().intern(n);
         }
 
-        std::string get_name() {
+        const std::string& get_name() {
+            return symbols().name(name);
+        }
+
+        symbol get_id() {
             return name;
         }
 
-        void set_current_zone(std::string z) {
+        void set_current_zone(symbol z) {
             zone = z;
         }
 
-        std::string get_current_zone() {
+        symbol get_current_zone() {
             return zone;
         }
         
-        void set_current_room(std::string r) {
+        void set_current_room(symbol r) {
             room = r;
         }
 
-        std::string get_current_room() {
+        symbol get_current_room() {
             return room;
         }
 
-        void on_tick() {
-            
+        void set_ticks_on_arrival(bool t) {
+            ticks_on_arrival = t;
+        }
+
+        bool get_ticks_on_arrival() {
+            return ticks_on_arrival;
+        }
+
+        void on_tick(uint64_t /*tick*/) override {
+
         };
 
         void on_message(event_scope scope, std::string message) {
 
         };
+
+        size_t& slot(occupancy o) {
+            return slots[o];
+        }
+};
+
+// The set of characters in a room or zone
+// It can be iterated in place without copying the shared pointers, and adding or removing a character is O(1):
+// each character stores its index in the list, so removal swaps the last character into the hole
+// (The order of the characters is not preserved)
+class occupant_list {
+    private:
+        occupancy                               kind;
+        std::vector<std::shared_ptr<character>> members;
+
+    public:
+        using const_iterator = std::vector<std::shared_ptr<character>>::const_iterator;
+
+        occupant_list(occupancy o) : kind(o) {}
+
+        void add(const std::shared_ptr<character>& c) {
+            c->slot(kind) = members.size();
+            members.push_back(c);
+        }
+
+        // Returns false if the character wasn't in this list
+        bool remove(const std::shared_ptr<character>& c) {
+            size_t i = c->slot(kind);
+            if ((i >= members.size()) || (members[i] != c)) return false;
+
+            if (i != members.size() - 1) {
+                members[i] = std::move(members.back());
+                members[i]->slot(kind) = i;
+            }
+            members.pop_back();
+            return true;
+        }
+
+        const_iterator begin() const {
+            return members.begin();
+        }
+
+        const_iterator end() const {
+            return members.end();
+        }
+
+        size_t size() const {
+            return members.size();
+        }
+
+        bool empty() const {
+            return members.empty();
+        }
 };
 
 // This class contains information and methods relating to the current player, and is created when a new telnet session is started
@@ -94,6 +277,7 @@ class player {
         std::string username;
         int         session_id;
         bool        connected = false;   // The player object may exist for a while after a client disconnects, to see if they reconnect
+        bool        admin = false;       // Can use the admin commands (set at login, from the data directory's admins file)
         std::string ip_address;
         int         port;
 
@@ -132,6 +316,14 @@ class player {
             pc = c;
         }
 
+        void set_admin(bool a) {
+            admin = a;
+        }
+
+        bool is_admin() {
+            return admin;
+        }
+
         std::shared_ptr<character> get_character() {
             return pc;
         }
@@ -160,54 +352,77 @@ class player {
 
 // A room is the container for all characters and objects in that room, and handles room-wide events
 // The zone object will create and register the rooms in that zone
-class room {
+class room : public tick_subscriber {
     private:
-        std::string name;
-        std::vector<std::shared_ptr<character>> characters;
+        symbol name = NO_SYMBOL;
+        symbol zone_id = NO_SYMBOL;                          // The zone this room belongs to
+        occupant_list characters{ROOM_SLOT};
         std::shared_ptr<event_queue>  eq;
-        std::map<std::string, std::shared_ptr<room>> exits;  // A collection of exits and the rooms they point to
+        std::vector<std::pair<symbol, std::shared_ptr<room>>> exits;  // The exits (by the ID of the exit name) and the rooms they point to
+                                                                      // A room only has a handful, so a flat vector beats a hash table here
 
     public:
         // Default Constructor
         room() {
-            std::cout << "Constructed room " << name << std::endl;
+            std::cout << "Constructed room " << get_name() << std::endl;
         }
     
-        room(std::string n, std::shared_ptr<event_queue> e) {
-            name = n;
+        room(std::string_view n, symbol z, std::shared_ptr<event_queue> e) {
+            name = symbols().intern(n);
+            zone_id = z;
             eq = e;
-            std::cout << "Constructed room " << name << std::endl;
+            #ifdef DEBUG
+            std::cout << "Constructed room " << n << std::endl;
+            #endif
         };
 
-        std::string get_name() {
+        const std::string& get_name() {
+            return symbols().name(name);
+        }
+
+        symbol get_id() {
             return name;
         }
 
-        void add_exit(std::string exit_name, std::shared_ptr<room> room_ptr) {
-            exits.insert({exit_name, room_ptr});
+        symbol get_zone() {
+            return zone_id;
+        }
+
+        void reserve_exits(size_t n) {
+            exits.reserve(n);
+        }
+
+        // Add an exit (they're shown to players in the order they're added, the area compiler sorts them by name)
+        void add_exit(symbol exit_name, std::shared_ptr<room> room_ptr) {
+            exits.push_back({exit_name, room_ptr});
+        }
+
+        // Get the room an exit leads to, given the ID of the exit name (nullptr if this room doesn't have that exit)
+        std::shared_ptr<room> get_exit(symbol exit_name) {
+            for (const std::pair<symbol, std::shared_ptr<room>>& e : exits) {
+                if (e.first == exit_name) return e.second;
+            }
+            return nullptr;
         }
 
-        // Return a copy of the exits map
-        // TODO:  Find a more efficient way of handling this
-        std::map<std::string, std::shared_ptr<room>> get_exits() {
+        // Get all the exits from this room (iterate it in place, don't copy it)
+        const std::vector<std::pair<symbol, std::shared_ptr<room>>>& get_exits() {
             return exits;
         }
 
         // Get a string of the valid exits for this room
         std::string get_exits_str() {
-            std::map<std::string, std::shared_ptr<room>>::iterator e = exits.begin();
             std::string exits_str;
 
-            while (e != exits.end()) {
-                exits_str += e->first + " ";
-                e++;
+            for (const std::pair<symbol, std::shared_ptr<room>>& e : exits) {
+                exits_str += symbols().name(e.first) + " ";
             }
 
             return exits_str;
         }
 
-        // Get a copy of the vector containing the current players in this room
-        std::vector<std::shared_ptr<character>> get_characters() {
+        // Get the current players in this room (iterate it in place, don't copy it)
+        const occupant_list& get_characters() {
             return characters;
         }
 
@@ -215,50 +430,44 @@ class room {
         std::string get_character_str() {
             std::string char_str;
 
-            for (std::shared_ptr<character> c : characters) {
+            for (const std::shared_ptr<character>& c : characters) {
                 char_str += "  " + c->get_name() + "\n";
             }
 
             return char_str;
         }
 
-        // Call on_tick() for all the characters in this room
-        void on_tick() {
-            for (std::shared_ptr<character> pc: characters) {
-                pc->on_tick();
-            }
+        void on_tick(uint64_t /*tick*/) override {
+
         };
 
         void enter_room(std::shared_ptr<character> c) {
             #ifdef DEBUG
-            std::cout << c->get_name() << " entered room " << name << std::endl;
+            std::cout << c->get_name() << " entered room " << get_name() << std::endl;
             #endif
             c->register_event_queue(eq);
             c->set_current_room(name);
-            characters.push_back(c);
+            characters.add(c);
         };  
 
         void leave_room(std::shared_ptr<character> c) {
-            std::vector<std::shared_ptr<character>>::iterator ichar = find(characters.begin(), characters.end(), c);
-
-            if (ichar != characters.end())
-            {
-                // Remove the character pointer from the vector
-                ichar = characters.erase(ichar);
-                c->set_current_room("");
+            // Remove the character pointer from the room
+            if (characters.remove(c)) {
+                c->set_current_room(NO_SYMBOL);
             }
         };
 };
 
 // The zone is the container for all the rooms in that zone, and handles zone-wide events
 // The world object will create and register each zone
-class zone {
+class zone : public tick_subscriber {
     private:
-        std::string name;
-        std::map<std::string, std::shared_ptr<room>> rooms;
+        symbol name = NO_SYMBOL;
+        std::unordered_map<symbol, std::shared_ptr<room>> rooms;
         std::shared_ptr<room> start_room;            // Pointer to the room that new characters start in
-        std::vector<std::shared_ptr<character>> characters;
+        occupant_list characters{ZONE_SLOT};
         std::shared_ptr<event_queue>  eq;
+        tick_set ticking;                            // Whatever in this zone (the zone included) wants calling every tick
 
     public:
         // Default Constructor
@@ -267,105 +476,97 @@ class zone {
         };
 
         zone(std::string n, std::shared_ptr<event_queue> e) {
-            name = n;
+            name = symbols().intern(n);
             eq = e;
 
-            std::cout << "Constructing zone " << name << ":" << std::endl;
-            zone_init();
+            std::cout << "Constructing zone " << n << std::endl;
         };
 
-        std::string get_name() {
+        const std::string& get_name() {
+            return symbols().name(name);
+        }
+
+        symbol get_id() {
             return name;
         }
 
-        // Get a copy of the vector containing the current players in this zone
-        std::vector<std::shared_ptr<character>> get_characters() {
+        // Get the current players in this zone (iterate it in place, don't copy it)
+        const occupant_list& get_characters() {
             return characters;
         }
 
-        void zone_init() {
-            // TODO:  Test rooms until we can read them in from a file
-            rooms.insert({"Nowhere",   std::shared_ptr<room>(new room("Nowhere",   eq))});  // Default room with no exits - if we end up here there's a problem
-            rooms.insert({"Start",     std::shared_ptr<room>(new room("Start",     eq))});  // Center room of 9
-            rooms.insert({"NorthEast", std::shared_ptr<room>(new room("NorthEast", eq))});
-            rooms.insert({"North",     std::shared_ptr<room>(new room("North",     eq))});
-            rooms.insert({"NorthWest", std::shared_ptr<room>(new room("NorthWest", eq))});
-            rooms.insert({"West",      std::shared_ptr<room>(new room("West",      eq))});
-            rooms.insert({"East",      std::shared_ptr<room>(new room("East",      eq))});
-            rooms.insert({"SouthEast", std::shared_ptr<room>(new room("SouthEast", eq))});
-            rooms.insert({"South",     std::shared_ptr<room>(new room("South",     eq))});
-            rooms.insert({"SouthWest", std::shared_ptr<room>(new room("SouthWest", eq))});
-            start_room = rooms["Start"];
-
-            // First create all the rooms, then populate the exits for each room (since they link to each other)
-            rooms["Start"]->add_exit("N", rooms["North"]);
-            rooms["Start"]->add_exit("S", rooms["South"]);
-            rooms["Start"]->add_exit("E", rooms["East"]);
-            rooms["Start"]->add_exit("W", rooms["West"]);
-
-            rooms["North"]->add_exit("S", rooms["Start"]);
-            rooms["North"]->add_exit("E", rooms["NorthEast"]);
-            rooms["North"]->add_exit("W", rooms["NorthWest"]);
-
-            rooms["South"]->add_exit("N", rooms["Start"]);
-            rooms["South"]->add_exit("E", rooms["SouthEast"]);
-            rooms["South"]->add_exit("W", rooms["SouthWest"]);
-
-            rooms["East"]->add_exit("N", rooms["NorthEast"]);
-            rooms["East"]->add_exit("S", rooms["SouthEast"]);
-            rooms["East"]->add_exit("W", rooms["Start"]);
-
-            rooms["West"]->add_exit("N", rooms["NorthWest"]);
-            rooms["West"]->add_exit("S", rooms["SouthWest"]);
-            rooms["West"]->add_exit("E", rooms["Start"]);
-
-            rooms["NorthEast"]->add_exit("S", rooms["East"]);
-            rooms["NorthEast"]->add_exit("W", rooms["North"]);
+        void reserve_rooms(size_t n) {
+            rooms.reserve(n);
+        }
 
-            rooms["NorthWest"]->add_exit("S", rooms["West"]);
-            rooms["NorthWest"]->add_exit("E", rooms["North"]);
+        // Add a room to this zone, keyed by its ID
+        void add_room(std::shared_ptr<room> r) {
+            rooms.insert({r->get_id(), r});
+        }
 
-            rooms["SouthEast"]->add_exit("N", rooms["East"]);
-            rooms["SouthEast"]->add_exit("W", rooms["South"]);
+        // Create a room in this zone (the world builds the zones from the area image)
+        std::shared_ptr<room> create_room(std::string_view room_name) {
+            std::shared_ptr<room> r = std::shared_ptr<room>(new room(room_name, name, eq));
+            add_room(r);
+            return r;
+        }
 
-            rooms["SouthWest"]->add_exit("N", rooms["West"]);
-            rooms["SouthWest"]->add_exit("E", rooms["South"]);
+        void set_start_room(std::shared_ptr<room> r) {
+            start_room = r;
         }
 
         // Register the character with the zone, and the zone name with the character
         void enter_zone(std::shared_ptr<character> c) {
-            std::cout << c->get_name() << " entered zone " << name << std::endl;
+            std::cout << c->get_name() << " entered zone " << get_name() << std::endl;
             c->register_event_queue(eq);
             c->set_current_zone(name);
-            characters.push_back(c);
+            characters.add(c);
+
+            // Carry on ticking if they were in the zone they came from
+            if (c->get_ticks_on_arrival()) {
+                ticking.subscribe(c.get());
+                c->set_ticks_on_arrival(false);
+            }
         };  
 
         // Remove the character from the zone
         void leave_zone(std::shared_ptr<character> c) {
-            std::vector<std::shared_ptr<character>>::iterator ichar = find(characters.begin(), characters.end(), c);
-
-            if (ichar != characters.end())
-            {
-                // Remove the character pointer from the vector
-                ichar = characters.erase(ichar);
-                c->set_current_zone("");
+            // Remove the character pointer from the zone
+            if (characters.remove(c)) {
+                c->set_current_zone(NO_SYMBOL);
+                // Each zone's ticks run on its own shard, so enter_zone subscribes them again wherever they arrive
+                c->set_ticks_on_arrival(ticking.unsubscribe(c.get()));
             }
         };
 
-        // Call on_tick() for all the rooms in this zone
-        void on_tick() {
-            std::map<std::string, std::shared_ptr<room>>::iterator r = rooms.begin();
+        void on_tick(uint64_t /*tick*/) override {
 
-            while (r != rooms.end())
-        	{
-                r->second->on_tick();
-                r++;
-            }
         };
 
+        // The rooms, characters (and the zone itself) subscribe here to be called every tick
+        tick_set& get_ticking() {
+            return ticking;
+        }
+
+        // Call everything in the zone that subscribed to ticks
+        void run_ticks(uint64_t tick) {
+            ticking.run(tick);
+        };
+
+        // Get all the rooms in this zone (iterate it in place, don't copy it)
+        const std::unordered_map<symbol, std::shared_ptr<room>>& get_rooms() {
+            return rooms;
+        }
+
+        // Get a pointer to a room object given its ID (nullptr if it isn't in this zone)
+        std::shared_ptr<room> get_room(symbol r) {
+            std::unordered_map<symbol, std::shared_ptr<room>>::iterator i = rooms.find(r);
+            return (i != rooms.end()) ? i->second : nullptr;
+        }
+
         // Get a pointer to a room object given the name
-        std::shared_ptr<room> get_room(std::string r) {
-            return rooms[r];
+        std::shared_ptr<room> get_room(std::string_view r) {
+            return get_room(symbols().find(r));
         }
 
         // Return the room that is the default starting room for this zone
@@ -1,18 +1,20 @@
 #ifndef TBDMUD_EVENTS_H_INCLUDED
 #define TBDMUD_EVENTS_H_INCLUDED
 
-namespace tbdmud {
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <variant>
+#include <vector>
+#include <symbols.h>
 
-// The different scopes of effect that an event can have
-enum event_type {
-    TYPE_NOT_SET,     // Indicates this value was not set
-    NOTICE,           // World broadcast messages - recipients depend on scope
-    SPEAK,            // Player speaking event - TELL, SAY, SHOUT or BROADCAST event depending on the event_scope
-    MOVE              // Move a character from one room to another
-};
+namespace tbdmud {
 
 // The different scopes of effect that an event can have
-// (This may or may not be used depending on the event_type)
+// (This may or may not be used depending on the kind of event)
 enum event_scope {
     SCOPE_NOT_SET,    // Indicates this value was not set
     WORLD,            // Affects everyone active on the server
@@ -23,121 +25,200 @@ enum event_scope {
     SELF              // Affects the origin character/object
 };
 
-class event_item {
+class event_pool;
+
+// A move-only handle to a message buffer borrowed from an event pool
+// The buffer goes back to the pool when the handle is destroyed, so there's no reference count or control block to allocate
+class pooled_text {
     private:
-        // These are overridden by the derivative event class or set by the originating entity
-        event_type  event_item_type = TYPE_NOT_SET;       // This should be overridden for each created message
-        std::string name = "test event";                  // Just for logging purposes
-        event_scope scope = SCOPE_NOT_SET;                // The scope of the effect of this events 
-        std::map<event_scope, std::string> message_map;   // Potential different messages for each scope
-        uint relative_tick = 0;                           // Set if the event should happen N ticks from now
-        std::string origin = "";                          // Name of the originating character or room
-        std::string target = "";                          // Neme of the target character or room (may be the same as the originator)
-        std::string origin_room = "";                     // Name of the originating room (in case of a move)
-        std::string target_room = "";                     // Neme of the target room      (in case of a move)
+        event_pool* pool  = nullptr;
+        uint        index = 0;
 
     public:
+        pooled_text() {}
 
-        void set_rtick(uint r) {
-            relative_tick = r;
-        };
-
-        uint get_rtick() {
-            return relative_tick;
-        };
-
-        void set_name(std::string n) {
-            name = n;
+        pooled_text(event_pool* p, uint i) {
+            pool  = p;
+            index = i;
         }
 
-        std::string get_name() {
-            return name;
-        }
+        pooled_text(const pooled_text&) = delete;
+        pooled_text& operator= (const pooled_text&) = delete;
 
-        void set_type(event_type et) {
-            event_item_type = et;
+        pooled_text(pooled_text&& other) {
+            pool  = other.pool;
+            index = other.index;
+            other.pool = nullptr;
         }
 
-        event_type get_type() {
-            return(event_item_type);
+        pooled_text& operator= (pooled_text&& other) {
+            if (this != &other) {
+                reset();
+                pool  = other.pool;
+                index = other.index;
+                other.pool = nullptr;
+            }
+            return *this;
         }
 
-        void set_scope(event_scope es) {
-            scope = es;
+        ~pooled_text() {
+            reset();
         }
 
-        event_scope get_scope() {
-            return(scope);
-        }
+        // Return the buffer to the pool (defined after event_pool)
+        void reset();
 
-        // Test if a message has been set for a given scope
-        bool has_message(event_scope es) {
-            std::map<event_scope, std::string>::iterator mi = message_map.find(es);
-            
-            return(mi != message_map.end());
-        };
+        // The text itself ("" if this handle is empty)
+        const std::string& str() const;
+};
 
-        // Set a message for a given scope
-        // Note:  This is how you can differentiate between an entry that hasn't been set, vs an entry that was deliberately set to ""
-        void set_message(event_scope es, std::string message) {
-            message_map.insert({es, message});
-            return;
-        };
+// A free list of message buffers, so steady-state traffic can reuse their storage instead of allocating
+// The counters only cover the text buffers - bench_core counts every allocation an event makes, including the queue's and the renders'
+// An event made in one zone's shard can be freed in another's (or the world's), so the pool is locked
+class event_pool {
+    private:
+        std::mutex              lock;
+        std::deque<std::string> buffers;                    // Every buffer this pool has ever allocated (a deque so references stay valid as it grows)
+        std::vector<uint>       free_buffers;
+        uint64_t                acquired = 0;               // Number of buffers handed out
+        uint64_t                buffer_allocs = 0;          // Number of times a buffer had to be created or grown
 
-        // Return the message for that scope
-        std::string get_message(event_scope es) {
-            // The map will return a default-constructed string ("") if the entry has not been set
-            return(message_map[es]);
-        };
+    public:
+        // Copy the text into a free buffer, allocating only if the free list is empty or the buffer is too small
+        pooled_text make_text(std::string_view text) {
+            std::lock_guard<std::mutex> guard(lock);
+            uint index;
+
+            if (free_buffers.empty()) {
+                index = buffers.size();
+                buffers.emplace_back();
+                free_buffers.reserve(buffers.size());   // Keep the free list as big as the pool, so releasing never allocates
+            }
+            else {
+                index = free_buffers.back();
+                free_buffers.pop_back();
+            }
+
+            std::string& buffer = buffers[index];
+            if (text.size() > buffer.capacity()) buffer_allocs++;
+            buffer.assign(text.data(), text.size());
 
-        void set_origin(std::string o) {
-            origin = o;
+            acquired++;
+            return pooled_text(this, index);
         }
 
-        std::string get_origin() {
-            return origin;
+        // Clear a buffer (keeping its storage) and put it back on the free list
+        void release(uint index) {
+            std::lock_guard<std::mutex> guard(lock);
+            buffers[index].clear();
+            free_buffers.push_back(index);
         }
 
-        void set_origin_room(std::string o) {
-            origin_room = o;
+        const std::string& get(uint index) {
+            std::lock_guard<std::mutex> guard(lock);
+            return buffers[index];
         }
 
-        std::string get_origin_room() {
-            return origin_room;
+        uint64_t get_acquired() {
+            std::lock_guard<std::mutex> guard(lock);
+            return acquired;
         }
 
-        void set_target(std::string t) {
-            target = t;
+        // Times a text buffer had to be created or grown - this should stop growing once the pool has warmed up
+        uint64_t get_buffer_allocs() {
+            std::lock_guard<std::mutex> guard(lock);
+            return buffer_allocs;
         }
 
-        std::string get_target() {
-            return target;
+        // Number of buffers currently in use
+        size_t in_use() {
+            std::lock_guard<std::mutex> guard(lock);
+            return buffers.size() - free_buffers.size();
         }
+};
+
+inline void pooled_text::reset() {
+    if (pool != nullptr) pool->release(index);
+    pool = nullptr;
+}
+
+inline const std::string& pooled_text::str() const {
+    static const std::string empty;
+    return (pool != nullptr) ? pool->get(index) : empty;
+}
 
-        void set_target_room(std::string t) {
-            target_room = t;
+// World broadcast messages, sent to everyone in the scope
+struct notice_event {
+    event_scope scope = WORLD;
+    pooled_text message;
+};
+
+// A player speaking - TELL, SAY, SHOUT or BROADCAST depending on the scope
+struct speak_event {
+    event_scope scope  = SCOPE_NOT_SET;    // TARGET = tell, ROOM = say, ZONE = shout, WORLD = broadcast
+    symbol      origin = NO_SYMBOL;        // The speaking character
+    symbol      target = NO_SYMBOL;        // The target character (only for TARGET)
+    pooled_text message;
+};
+
+// Move a character from one room to another
+// When the zones differ the move is handed from one zone's shard to the other's (origin_zone is NO_SYMBOL when logging in)
+struct move_event {
+    symbol origin      = NO_SYMBOL;        // The character moving
+    symbol origin_zone = NO_SYMBOL;        // The zone they're leaving
+    symbol origin_room = NO_SYMBOL;        // The room they're leaving
+    symbol target_zone = NO_SYMBOL;        // The zone they're entering
+    symbol target_room = NO_SYMBOL;        // The room they're entering
+};
+
+// Every kind of event, stored by value in the event queue and dispatched with std::visit
+using event = std::variant<notice_event, speak_event, move_event>;
+
+// Name of the kind of event, just for logging purposes
+inline const char* event_name(const event& e) {
+    static const char* names[] = {"NOTICE", "SPEAK", "MOVE"};
+    return names[e.index()];
+}
+
+// Where other threads drop work for an owner that runs on its own strand (a zone's shard, or the world)
+// Senders only hold the lock long enough to append, and the owner takes the whole batch at once
+template<typename T>
+class mailbox {
+    private:
+        std::mutex     lock;
+        std::vector<T> pending;
+
+    public:
+        // Returns true if the mailbox was empty, in which case the sender should schedule the owner to collect it
+        bool deliver(T&& item) {
+            std::lock_guard<std::mutex> guard(lock);
+            bool was_empty = pending.empty();
+            pending.push_back(std::move(item));
+            return was_empty;
         }
 
-        std::string get_target_room() {
-            return target_room;
+        // Swap everything delivered so far into batch (which should be empty)
+        void collect(std::vector<T>& batch) {
+            std::lock_guard<std::mutex> guard(lock);
+            batch.swap(pending);
         }
 };
 
-// Wrap a derived event class so we can put different derived event types in the same priority queue
-// TODO:  Figure out how to properly handle different derived classes in the same queue, and how to restore derived types without slicing
+// Wrap an event with the data the event queue needs to schedule it
 class event_wrapper {
     private:
         // These are set by the event queue
         uint      unique_id = 0;                               // The unique sequential id for this event (set by the event queue)
-        uint64_t scheduled_tick = 0;                          // The tick (server time) when this event is scheduled to happen (0 = immediate)
-        std::shared_ptr<event_item> event;
+        uint64_t scheduled_tick = 0;                          // The tick (server time) when this event is scheduled to happen (equal to the current tick = immediate)
+        std::chrono::steady_clock::time_point queued_at;       // When an immediate event was added (delayed events are due when their tick starts)
+        tbdmud::event e;
 
     public:
 
         event_wrapper() {}
 
-        event_wrapper(std::shared_ptr<event_item> e) {
-            event = e;
+        event_wrapper(tbdmud::event&& ev) {
+            e = std::move(ev);
         };
 
         void set_id(uint i) {
@@ -148,75 +229,154 @@ class event_wrapper {
             scheduled_tick = s;
         }
 
+        void set_queued_at(std::chrono::steady_clock::time_point t) {
+            queued_at = t;
+        }
+
+        std::chrono::steady_clock::time_point get_queued_at() const {
+            return queued_at;
+        }
+
         uint id() {
             return unique_id;
         }
 
         // Get the world-relative tick when this event will be valid
-        uint64_t stick() {
+        uint64_t stick() const {
             return scheduled_tick;
         }
 
-        void set_event(std::shared_ptr<event_item> e) {
-            event = e;
+        void set_event(tbdmud::event&& ev) {
+            e = std::move(ev);
         }
 
-        std::shared_ptr<event_item> get_event() {
-            return(event);
+        // Move the event out of the wrapper
+        tbdmud::event take_event() {
+            return(std::move(e));
         }
+};
 
-        // Overload operators
-        bool operator< (const event_wrapper& other) {
-            if (event->get_rtick() == other.event->get_rtick())  {
-                if (unique_id < other.unique_id) return true;
-                else return false;
+// A hierarchical timing wheel, keyed on the absolute scheduled tick of each item
+// Level 0 holds the items due within the current 256-tick block, one slot per tick.  Each level above that covers
+// 256 times the range of the one below it, and its slots are cascaded down as the wheel turns into their range.
+// Inserting is O(1), and each tick only has to move a single bucket into the due list.
+// Items scheduled for the same tick come out in the order they were inserted (which is the order of their unique_id).
+// (T must provide a stick() function returning the absolute tick it is scheduled for)
+template <typename T>
+class timing_wheel {
+    private:
+        static const uint     level_bits = 8;
+        static const uint     num_slots  = 1 << level_bits;   // Slots per level
+        static const uint     num_levels = 4;                 // 4 levels cover 2^32 ticks - anything further out waits in overflow
+        static const uint64_t slot_mask  = num_slots - 1;
+
+        uint64_t       now = 0;                                // The tick the wheel has turned to
+        size_t         pending = 0;                            // Number of items in the wheel (not counting the due list)
+        std::vector<T> slots[num_levels][num_slots];
+        std::vector<T> overflow;                               // Items scheduled more than 2^32 ticks out
+        std::deque<T>  due;                                    // Items due at or before now, in FIFO order
+
+        // Put an item in the level where its tick first differs from the current tick
+        // (Keeping the whole block aligned means a slot is always cascaded before anything lower down can land on the same tick)
+        void place(T&& item) {
+            uint64_t t = item.stick();
+
+            if (t <= now) {
+                due.push_back(std::move(item));
+                return;
             }
-            else if (event->get_rtick() < other.event->get_rtick()) return true;
-            else return false;
-        };
 
-        bool operator> (const event_wrapper& other) {
-            if (event->get_rtick() == other.event->get_rtick())  {
-                if (unique_id > other.unique_id) return true;
-                else return false;
+            uint level = (63 - __builtin_clzll(t ^ now)) / level_bits;
+            if (level >= num_levels) {
+                overflow.push_back(std::move(item));
+            }
+            else {
+                slots[level][(t >> (level * level_bits)) & slot_mask].push_back(std::move(item));
             }
-            else if (event->get_rtick() > other.event->get_rtick()) return true;
-            else return false;
+            pending++;
         }
 
-        friend bool operator< (const event_wrapper& other, const event_wrapper& rhs);
-        friend bool operator> (const event_wrapper& other, const event_wrapper& rhs);
-};
+        // Re-place every item in a bucket now that the wheel has turned into its range
+        void cascade(std::vector<T>& bucket) {
+            std::vector<T> items;
+            items.swap(bucket);
+            pending -= items.size();
 
-// Overloaded < operator for priority queue event comparisons
-bool operator< (const event_wrapper& lhs, const event_wrapper& rhs) {
-    if (lhs.event->get_rtick() == rhs.event->get_rtick())  {
-        if (lhs.unique_id < rhs.unique_id) return true;
-        else return false;
-    }
-    else if (lhs.event->get_rtick() < rhs.event->get_rtick()) return true;
-    else return false;
-};
+            for (T& item : items) {
+                place(std::move(item));
+            }
+        }
+
+        // Turn the wheel forward by exactly one tick
+        void step() {
+            now++;
 
-// Overloaded > operator for priority queue event comparisons
-bool operator> (const event_wrapper& lhs, const event_wrapper& rhs) {
-    if (lhs.event->get_rtick() == rhs.event->get_rtick())  {
-        if (lhs.unique_id > rhs.unique_id) return true;
-        else return false;
-    }
-    else if (lhs.event->get_rtick() > rhs.event->get_rtick()) return true;
-    else return false;
+            // Find the highest level whose slot index rolled over with this tick, then cascade from the top down
+            // so items falling out of a higher level can be cascaded again by the level below
+            uint top = 0;
+            while ((top < num_levels) && (((now >> (top * level_bits)) & slot_mask) == 0)) top++;
+
+            if (top == num_levels) cascade(overflow);
+            for (uint level = std::min(top, num_levels - 1); level > 0; level--) {
+                cascade(slots[level][(now >> (level * level_bits)) & slot_mask]);
+            }
+
+            std::vector<T>& bucket = slots[0][now & slot_mask];
+            pending -= bucket.size();
+            for (T& item : bucket) {
+                due.push_back(std::move(item));
+            }
+            bucket.clear();
+        }
+
+    public:
+        void insert(T&& item) {
+            place(std::move(item));
+        }
+
+        // Turn the wheel up to the given tick, moving everything that becomes due into the due list
+        void advance_to(uint64_t tick) {
+            while (now < tick) {
+                // Nothing left to cascade, so there's no need to visit every slot in between
+                if (pending == 0) {
+                    now = tick;
+                    break;
+                }
+                step();
+            }
+        }
+
+        // Move the oldest due item into the passed-in reference, returns false if nothing is due
+        bool pop(T& item) {
+            if (due.empty()) return false;
+
+            item = std::move(due.front());
+            due.pop_front();
+            return true;
+        }
+
+        bool has_due() {
+            return !due.empty();
+        }
+
+        // Total number of items waiting in the wheel, due or not
+        size_t size() {
+            return pending + due.size();
+        }
 };
 
-// A priority queue of event wrappers
+// A queue of event wrappers
 // The wrapper contains data about when the event should be processed
-// The event could be one of a number of derivative event classes
-// TODO:  Figure out how to properly handle different derived classes in the same queue, and how to restore derived types without slicing
+// The event itself is one of the typed event records, held by value
 class event_queue {
     private:
         uint64_t*                          world_elapsed_ticks;
         uint                               event_counter;
-        std::priority_queue<event_wrapper> event_pq;
+        event_pool                         pool;         // Declared before the wheel so any pending messages are returned before the pool goes away
+        timing_wheel<event_wrapper>        event_wheel;
+        std::function<void()>              on_ready;     // Called when an immediate event is added, so the owner can schedule a drain
+        uint64_t                           seen_tick = 0;                   // The last tick the queue was drained on, and when that drain started
+        std::chrono::steady_clock::time_point seen_tick_at;                 // (A delayed event has been due since then)
 
     public:
         std::string name;  // TODO:  Just for testing
@@ -232,15 +392,19 @@ class event_queue {
             world_elapsed_ticks = wet;
         };
 
-        // Provide a shared pointer to an event - events will be sorted by time and then ID as they are added to the priority queue
-        void add_event(std::shared_ptr<event_item> e) {
+        // Copy message text into a buffer from this queue's pool
+        pooled_text make_text(std::string_view text) {
+            return pool.make_text(text);
+        };
+
+        // Hand an event over to the queue, to happen rtick ticks from now (0 = immediately)
+        // Events will be sorted by scheduled tick and then ID as they are added to the timing wheel
+        void add_event(tbdmud::event&& e, uint rtick = 0) {
             event_wrapper ew;
-            uint ec;
             
             #ifdef DEBUG
-            std::cout << "Add event " << e->get_name() << std::endl;
+            std::cout << "Add event " << event_name(e) << std::endl;
             #endif
-            ec = event_counter;
 
             #ifdef DEBUG
             std::cout << "Set Event ID:  " << event_counter << std::endl; 
@@ -250,33 +414,55 @@ class event_queue {
 
             // Set the world-relative tick that this event will trigger on
             #ifdef DEBUG
-            std::cout << "Set event system tick to trigger on:  " << *world_elapsed_ticks << " + " << e->get_rtick() << std::endl; 
+            std::cout << "Set event system tick to trigger on:  " << *world_elapsed_ticks << " + " << rtick << std::endl; 
             #endif
-            ew.set_stick(*world_elapsed_ticks + e->get_rtick());
+            ew.set_stick(*world_elapsed_ticks + rtick);
+            if (rtick == 0) ew.set_queued_at(std::chrono::steady_clock::now());
+
+            ew.set_event(std::move(e));             // Attach the event object to this wrapper
+            event_wheel.insert(std::move(ew));      // Schedule the event in the timing wheel
 
-            ew.set_event(e);    // Attach the event object to this wrapper
-            event_pq.push(ew);  // Push the event into the priority queue
+            // Wake the owner up if this event should be handled right away
+            // (Delayed events are picked up by the drain that follows each tick)
+            if ((rtick == 0) && on_ready) on_ready();
         };
 
-        // Return the most current event
-        std::shared_ptr<event_item> next_event() {
-            event_wrapper ew;
+        // Register the function to call when an immediate event is added to the queue
+        void set_ready_handler(std::function<void()> h) {
+            on_ready = h;
+        };
 
-            // If the queue has something in it, *AND*
-            if (!event_pq.empty()) {
-                ew = event_pq.top();
+        // Move the next event that is due into the passed-in reference, returns false if there isn't one
+        // If waited is given, it's set to how long the event has been due
+        bool next_event(tbdmud::event& e, std::chrono::steady_clock::duration* waited = nullptr) {
+            event_wrapper ew;
 
-                // If the topmost item in the priority queue has a time equal to or less than now
-                if(ew.stick() <= *world_elapsed_ticks) {
-                    event_pq.pop();           // Pop it off the queue and return it
-                    return ew.get_event();
+            // Turn the wheel up to the current time, then hand back the oldest event that is due
+            if ((waited != nullptr) && ((*world_elapsed_ticks != seen_tick) || (seen_tick_at.time_since_epoch().count() == 0))) {
+                seen_tick    = *world_elapsed_ticks;
+                seen_tick_at = std::chrono::steady_clock::now();
+            }
+            event_wheel.advance_to(*world_elapsed_ticks);
+            if (event_wheel.pop(ew)) {
+                if (waited != nullptr) {
+                    std::chrono::steady_clock::time_point due = (ew.get_queued_at().time_since_epoch().count() != 0) ? ew.get_queued_at() : seen_tick_at;
+                    *waited = std::chrono::steady_clock::now() - due;
                 }
+                e = ew.take_event();
+                return true;
             }
 
-            // Otherwise, if we didn't pop an event off the queue, just return nullptr
-            return nullptr;
+            return false;
+        };
+
+        // Number of events waiting in the queue, due or not
+        size_t size() {
+            return event_wheel.size();
         };
 
+        event_pool& get_pool() {
+            return pool;
+        };
 };
 
 }  // end namespace tbdmud
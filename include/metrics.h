@@ -0,0 +1,336 @@
+// This file contains the metrics registry - counters, gauges and histograms any part of the server can update from any thread -
+// and the loopback HTTP endpoint that serves them to Prometheus
+// Updating a metric is a relaxed atomic add, so it's cheap enough for the hot paths; looking one up takes a lock, so look it up once and keep it
+
+#ifndef TBDMUD_METRICS_H_INCLUDED
+#define TBDMUD_METRICS_H_INCLUDED
+
+#include <iostream>
+#include <boost/asio.hpp>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iomanip>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+
+namespace tbdmud {
+
+class counter {
+    private:
+        std::atomic<uint64_t> value{0};
+
+    public:
+        void add(uint64_t n = 1) {
+            value.fetch_add(n, std::memory_order_relaxed);
+        }
+
+        uint64_t get() const {
+            return value.load(std::memory_order_relaxed);
+        }
+};
+
+class gauge {
+    private:
+        std::atomic<int64_t> value{0};
+        double               scale;
+
+    public:
+        gauge(double s = 1.0) : scale(s) {}
+
+        void set(int64_t v) {
+            value.store(v, std::memory_order_relaxed);
+        }
+
+        void add(int64_t n) {
+            value.fetch_add(n, std::memory_order_relaxed);
+        }
+
+        int64_t get() const {
+            return value.load(std::memory_order_relaxed);
+        }
+
+        // In the reported unit
+        double get_scaled() const {
+            return get() * scale;
+        }
+};
+
+// A log-linear histogram in the style of HdrHistogram - every power of two is split into 32 buckets, so any value is
+// recorded to within about 3% whatever its size, in a fixed array with no allocation
+// Values are whole numbers (nanoseconds, bytes, messages), scale converts them to the unit they're reported in
+class histogram {
+    private:
+        static const int      SUB_BITS    = 5;
+        static const uint64_t SUB_BUCKETS = 1 << SUB_BITS;
+        static const size_t   NUM_BUCKETS = (64 - SUB_BITS + 1) * SUB_BUCKETS;   // Up to the octave from 2^63, the top one bucket() can return
+
+        std::array<std::atomic<uint64_t>, NUM_BUCKETS> buckets = {};
+        std::atomic<uint64_t> count{0};
+        std::atomic<uint64_t> sum{0};
+        std::atomic<uint64_t> max{0};
+        double                scale;
+
+        static size_t bucket(uint64_t v) {
+            if (v < 2 * SUB_BUCKETS) return v;
+            int shift = (63 - __builtin_clzll(v)) - SUB_BITS;
+            return shift * SUB_BUCKETS + (v >> shift);
+        }
+
+        // The largest value that lands in bucket i
+        static uint64_t bucket_top(size_t i) {
+            if (i < 2 * SUB_BUCKETS) return i;
+            int shift = i / SUB_BUCKETS - 1;
+            uint64_t sub = i % SUB_BUCKETS + SUB_BUCKETS;
+            return ((sub + 1) << shift) - 1;
+        }
+
+    public:
+        histogram(double s = 1.0) : scale(s) {}
+
+        void record(uint64_t v) {
+            buckets[bucket(v)].fetch_add(1, std::memory_order_relaxed);
+            count.fetch_add(1, std::memory_order_relaxed);
+            sum.fetch_add(v, std::memory_order_relaxed);
+
+            uint64_t m = max.load(std::memory_order_relaxed);
+            while ((v > m) && !max.compare_exchange_weak(m, v, std::memory_order_relaxed)) {}
+        }
+
+        // A negative duration (the clock read out of order across threads) counts as 0
+        void record(std::chrono::steady_clock::duration d) {
+            record((uint64_t) std::max<int64_t>(0, std::chrono::duration_cast<std::chrono::nanoseconds>(d).count()));
+        }
+
+        // The value q of the way through everything recorded (0.5 = median), in the reported unit
+        double percentile(double q) const {
+            uint64_t total = count.load(std::memory_order_relaxed);
+            if (total == 0) return 0;
+
+            uint64_t rank = (uint64_t) (q * total);
+            if (rank >= total) rank = total - 1;
+
+            uint64_t seen = 0;
+            for (size_t i = 0; i < NUM_BUCKETS; i++) {
+                seen += buckets[i].load(std::memory_order_relaxed);
+                if (seen > rank) return std::min(bucket_top(i), max.load(std::memory_order_relaxed)) * scale;
+            }
+            return get_max();
+        }
+
+        uint64_t get_count() const {
+            return count.load(std::memory_order_relaxed);
+        }
+
+        double get_sum() const {
+            return sum.load(std::memory_order_relaxed) * scale;
+        }
+
+        double get_max() const {
+            return max.load(std::memory_order_relaxed) * scale;
+        }
+};
+
+// Every metric by name (and labels, for the ones that come in sets - one per zone, one per command)
+class metrics_registry {
+    private:
+        enum kind {
+            COUNTER,
+            GAUGE,
+            HISTOGRAM
+        };
+
+        struct family {
+            kind        type;
+            std::string help;
+            std::map<std::string, std::unique_ptr<counter>>   counters;     // Keyed by labels
+            std::map<std::string, std::unique_ptr<gauge>>     gauges;
+            std::map<std::string, std::unique_ptr<histogram>> histograms;
+        };
+
+        std::mutex                    lock;
+        std::map<std::string, family> families;
+
+        family& get_family(const std::string& name, kind type, const std::string& help) {
+            std::map<std::string, family>::iterator f = families.find(name);
+            if (f == families.end()) {
+                f = families.insert({name, family()}).first;
+                f->second.type = type;
+                f->second.help = help;
+            }
+            return f->second;
+        }
+
+        static std::string with_labels(const std::string& name, const std::string& labels, const std::string& extra = "") {
+            std::string all = labels;
+            if (!extra.empty()) all += (all.empty() ? "" : ",") + extra;
+            return all.empty() ? name : name + "{" + all + "}";
+        }
+
+        static std::string number(double v) {
+            std::ostringstream s;
+            s << std::setprecision(9) << v;
+            return s.str();
+        }
+
+    public:
+        // Find or create a metric - the reference stays good for as long as the program runs
+        // labels are in Prometheus form without the braces:  zone="Zion"
+        counter& get_counter(const std::string& name, const std::string& help, const std::string& labels = "") {
+            std::lock_guard<std::mutex> guard(lock);
+            std::unique_ptr<counter>& c = get_family(name, COUNTER, help).counters[labels];
+            if (!c) c.reset(new counter());
+            return *c;
+        }
+
+        // scale converts the values to the reported unit (1e-9 for nanoseconds reported as seconds)
+        gauge& get_gauge(const std::string& name, const std::string& help, double scale = 1.0, const std::string& labels = "") {
+            std::lock_guard<std::mutex> guard(lock);
+            std::unique_ptr<gauge>& g = get_family(name, GAUGE, help).gauges[labels];
+            if (!g) g.reset(new gauge(scale));
+            return *g;
+        }
+
+        histogram& get_histogram(const std::string& name, const std::string& help, double scale = 1.0, const std::string& labels = "") {
+            std::lock_guard<std::mutex> guard(lock);
+            std::unique_ptr<histogram>& h = get_family(name, HISTOGRAM, help).histograms[labels];
+            if (!h) h.reset(new histogram(scale));
+            return *h;
+        }
+
+        // Everything in the Prometheus text format (histograms are reported as summaries, with their quantiles worked out here)
+        std::string prometheus() {
+            const double quantiles[] = {0.5, 0.9, 0.99, 0.999};
+            std::lock_guard<std::mutex> guard(lock);
+            std::string out;
+
+            for (std::pair<const std::string, family>& f : families) {
+                const std::string& name = f.first;
+                out += "# HELP " + name + " " + f.second.help + "\n";
+
+                switch (f.second.type) {
+                    case COUNTER:
+                        out += "# TYPE " + name + " counter\n";
+                        for (std::pair<const std::string, std::unique_ptr<counter>>& c : f.second.counters) {
+                            out += with_labels(name, c.first) + " " + std::to_string(c.second->get()) + "\n";
+                        }
+                        break;
+                    case GAUGE:
+                        out += "# TYPE " + name + " gauge\n";
+                        for (std::pair<const std::string, std::unique_ptr<gauge>>& g : f.second.gauges) {
+                            out += with_labels(name, g.first) + " " + number(g.second->get_scaled()) + "\n";
+                        }
+                        break;
+                    case HISTOGRAM:
+                        out += "# TYPE " + name + " summary\n";
+                        for (std::pair<const std::string, std::unique_ptr<histogram>>& h : f.second.histograms) {
+                            for (double q : quantiles) {
+                                out += with_labels(name, h.first, "quantile=\"" + number(q) + "\"") + " " + number(h.second->percentile(q)) + "\n";
+                            }
+                            out += with_labels(name + "_sum", h.first) + " " + number(h.second->get_sum()) + "\n";
+                            out += with_labels(name + "_count", h.first) + " " + std::to_string(h.second->get_count()) + "\n";
+                        }
+                        break;
+                }
+            }
+
+            return out;
+        }
+
+        // Everything as text for a person to read (the in-game stats command)
+        std::string summary() {
+            std::lock_guard<std::mutex> guard(lock);
+            std::ostringstream out;
+
+            for (std::pair<const std::string, family>& f : families) {
+                for (std::pair<const std::string, std::unique_ptr<counter>>& c : f.second.counters) {
+                    out << "  " << std::left << std::setw(56) << with_labels(f.first, c.first) << " " << c.second->get() << "\n";
+                }
+                for (std::pair<const std::string, std::unique_ptr<gauge>>& g : f.second.gauges) {
+                    out << "  " << std::left << std::setw(56) << with_labels(f.first, g.first) << " " << number(g.second->get_scaled()) << "\n";
+                }
+                for (std::pair<const std::string, std::unique_ptr<histogram>>& h : f.second.histograms) {
+                    histogram& hg = *h.second;
+                    out << "  " << std::left << std::setw(56) << with_labels(f.first, h.first) << " n=" << hg.get_count()
+                        << " p50=" << number(hg.percentile(0.5)) << " p99=" << number(hg.percentile(0.99))
+                        << " p999=" << number(hg.percentile(0.999)) << " max=" << number(hg.get_max()) << "\n";
+                }
+            }
+
+            return out.str();
+        }
+};
+
+inline metrics_registry& metrics() {
+    static metrics_registry registry;
+    return registry;
+}
+
+// Serves the metrics over HTTP for Prometheus to scrape - bound to the loopback address only, so it can't be reached from outside the box
+class metrics_endpoint {
+    private:
+        boost::asio::io_context&       io_context;
+        boost::asio::ip::tcp::acceptor acceptor;
+
+        // One scrape - read the request, answer it, close
+        struct request : std::enable_shared_from_this<request> {
+            boost::asio::ip::tcp::socket socket;
+            boost::asio::streambuf       in{8192};
+            std::string                  response;
+
+            request(boost::asio::ip::tcp::socket&& s) : socket(std::move(s)) {}
+
+            void start() {
+                std::shared_ptr<request> self = shared_from_this();
+                boost::asio::async_read_until(socket, in, "\r\n\r\n", [this, self] (boost::system::error_code error, size_t) {
+                    if (error) return;
+
+                    std::string line;
+                    std::istream text(&in);
+                    std::getline(text, line);
+
+                    std::string method, path;
+                    std::istringstream words(line);
+                    words >> method >> path;
+
+                    if ((method == "GET") && ((path == "/metrics") || (path == "/"))) {
+                        std::string body = metrics().prometheus();
+                        response = "HTTP/1.1 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: " + std::to_string(body.size()) +
+                                   "\r\nConnection: close\r\n\r\n" + body;
+                    }
+                    else {
+                        response = "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+                    }
+
+                    boost::asio::async_write(socket, boost::asio::buffer(response), [this, self] (boost::system::error_code /*error*/, size_t) {
+                        boost::system::error_code ignored;
+                        socket.shutdown(boost::asio::ip::tcp::socket::shutdown_both, ignored);
+                    });
+                });
+            }
+        };
+
+        void async_accept() {
+            acceptor.async_accept(boost::asio::make_strand(io_context), [this] (boost::system::error_code error, boost::asio::ip::tcp::socket socket) {
+                if (error == boost::asio::error::operation_aborted) return;
+                if (!error) std::make_shared<request>(std::move(socket))->start();
+                async_accept();
+            });
+        }
+
+    public:
+        metrics_endpoint(boost::asio::io_context& io, uint16_t port)
+            : io_context(io), acceptor(io, boost::asio::ip::tcp::endpoint(boost::asio::ip::address_v4::loopback(), port)) {
+            std::cout << "Metrics served on http://127.0.0.1:" << port << "/metrics" << std::endl;
+            async_accept();
+        }
+};
+
+}  // end namespace tbdmud
+
+#endif
@@ -0,0 +1,75 @@
+// This file contains the online index - who is logged in, by case-folded name
+// It's the one place that says whether a name is taken, so logins and tells look names up in it instead of searching the sessions
+
+#ifndef TBDMUD_ONLINE_H_INCLUDED
+#define TBDMUD_ONLINE_H_INCLUDED
+
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <players.h>
+#include <symbols.h>
+
+namespace tbdmud {
+
+class online_index {
+    private:
+        // A name maps to NO_SYMBOL while its account is loading, then to the character once they're in the world
+        std::unordered_map<std::string, symbol>  names;
+        std::unordered_set<std::string>          reserved;      // Names nobody can log in as (the world, the zones)
+        mutable std::shared_mutex                lock;          // The world changes it, the shards look names up
+
+    public:
+        // Keep a name from ever being used for a player
+        void reserve(std::string_view name) {
+            std::unique_lock<std::shared_mutex> guard(lock);
+            reserved.insert(fold_name(name));
+        }
+
+        // Take a name for someone logging in, returns false if it's reserved or someone already has it
+        bool claim(std::string_view name) {
+            std::string folded = fold_name(name);
+            std::unique_lock<std::shared_mutex> guard(lock);
+            if (reserved.count(folded) > 0) return false;
+            return names.insert({std::move(folded), NO_SYMBOL}).second;
+        }
+
+        // They're in the world now, so tells can find them
+        void add(std::string_view name, symbol character) {
+            std::unique_lock<std::shared_mutex> guard(lock);
+            names[fold_name(name)] = character;
+        }
+
+        // They left (or never made it in), the name is free again
+        void release(std::string_view name) {
+            std::string folded = fold_name(name);
+            std::unique_lock<std::shared_mutex> guard(lock);
+            names.erase(folded);
+        }
+
+        // The character logged in under a name, in any case (NO_SYMBOL if nobody by that name is in the world)
+        symbol find(std::string_view name) const {
+            std::string folded = fold_name(name);
+            std::shared_lock<std::shared_mutex> guard(lock);
+            std::unordered_map<std::string, symbol>::const_iterator i = names.find(folded);
+            return (i != names.end()) ? i->second : NO_SYMBOL;
+        }
+
+        bool is_reserved(std::string_view name) const {
+            std::string folded = fold_name(name);
+            std::shared_lock<std::shared_mutex> guard(lock);
+            return reserved.count(folded) > 0;
+        }
+
+        size_t size() const {
+            std::shared_lock<std::shared_mutex> guard(lock);
+            return names.size();
+        }
+};
+
+}  // end namespace tbdmud
+
+#endif
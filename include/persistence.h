@@ -0,0 +1,490 @@
+// This file contains the world store, which saves the world to disk as a snapshot plus a write-ahead log
+// The game only ever queues small records for it - the log is written, synced and compacted into snapshots on the store's own thread,
+// so saving never holds up a tick or the event processing
+
+#ifndef TBDMUD_PERSISTENCE_H_INCLUDED
+#define TBDMUD_PERSISTENCE_H_INCLUDED
+
+#include <iostream>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace tbdmud {
+
+// Where a character was when they were last saved
+struct saved_location {
+    std::string zone;
+    std::string room;
+};
+
+// Everything that can change the saved world
+// Every record sets a value outright rather than changing it, so replaying one that's already in the snapshot is harmless
+enum record_type : uint8_t {
+    CHARACTER_LOCATION = 1,   // name, zone, room
+    WORLD_STATE        = 2,   // tick, sun, moon
+    CHARACTER_SAVED    = 3    // name - their account has their location now, so the world can forget it
+};
+
+struct store_record {
+    record_type type;
+    std::string name;
+    std::string zone;
+    std::string room;
+    uint64_t    tick = 0;
+    bool        sun  = false;
+    bool        moon = false;
+};
+
+// On disk, the log and the snapshot are both a series of records:  [payload length][checksum of payload][payload]
+// A torn or corrupt record at the end of the log (from a crash mid-write) ends recovery there and is cut off
+class world_store {
+    private:
+        const size_t                     SNAPSHOT_LOG_BYTES = 1 << 20;             // Compact the log into a snapshot when it grows past this
+        const std::chrono::seconds       SNAPSHOT_INTERVAL  = std::chrono::seconds(300);  // Or when it's had anything in it this long
+        const char*                      SNAPSHOT_MAGIC     = "TBDSNAP1";
+
+        std::string                      log_path;
+        std::string                      snapshot_path;
+        int                              log_fd = -1;
+        size_t                           log_bytes = 0;                             // Size of the log since the last snapshot
+        std::chrono::steady_clock::time_point last_snapshot;
+
+        // Records the game has queued that haven't been written yet
+        std::thread                      writer;
+        std::mutex                       queue_lock;
+        std::condition_variable          wake;
+        std::vector<store_record>        pending;
+        bool                             stopping = false;
+
+        // The saved world as of the last record written - only changed on the writer thread, read under state_lock
+        std::mutex                                        state_lock;
+        std::unordered_map<std::string, saved_location>   characters;
+        uint64_t                                          saved_tick = 0;
+        bool                                              saved_sun  = false;
+        bool                                              saved_moon = false;
+
+        std::atomic<uint64_t>            records_written{0};
+        std::atomic<uint64_t>            snapshots_written{0};
+
+        // FNV-1a, to catch torn or corrupt records
+        static uint32_t checksum(const char* data, size_t size) {
+            uint32_t h = 2166136261u;
+            for (size_t i = 0; i < size; i++) {
+                h = (h ^ (unsigned char) data[i]) * 16777619u;
+            }
+            return h;
+        }
+
+        static void put_u32(std::string& out, uint32_t v) {
+            out.append(reinterpret_cast<const char*>(&v), sizeof(v));
+        }
+
+        static void put_u64(std::string& out, uint64_t v) {
+            out.append(reinterpret_cast<const char*>(&v), sizeof(v));
+        }
+
+        static void put_str(std::string& out, const std::string& s) {
+            uint16_t n = s.size();
+            out.append(reinterpret_cast<const char*>(&n), sizeof(n));
+            out.append(s.data(), n);
+        }
+
+        // Append the on-disk form of a record to out
+        static void encode(const store_record& r, std::string& out) {
+            std::string payload;
+            payload.push_back((char) r.type);
+
+            switch (r.type) {
+                case CHARACTER_LOCATION:
+                    put_str(payload, r.name);
+                    put_str(payload, r.zone);
+                    put_str(payload, r.room);
+                    break;
+                case CHARACTER_SAVED:
+                    put_str(payload, r.name);
+                    break;
+                case WORLD_STATE:
+                    put_u64(payload, r.tick);
+                    payload.push_back(r.sun);
+                    payload.push_back(r.moon);
+                    break;
+            }
+
+            put_u32(out, payload.size());
+            put_u32(out, checksum(payload.data(), payload.size()));
+            out += payload;
+        }
+
+        // Reads the records back out of a buffer, stopping at the first one that's incomplete or corrupt
+        class record_reader {
+            private:
+                const std::string& data;
+                size_t             pos = 0;
+
+                template<typename T>
+                bool get(const std::string& d, size_t& p, size_t end, T& v) {
+                    if (p + sizeof(T) > end) return false;
+                    std::memcpy(&v, d.data() + p, sizeof(T));
+                    p += sizeof(T);
+                    return true;
+                }
+
+                bool get_str(size_t& p, size_t end, std::string& s) {
+                    uint16_t n;
+                    if (!get(data, p, end, n) || (p + n > end)) return false;
+                    s.assign(data.data() + p, n);
+                    p += n;
+                    return true;
+                }
+
+            public:
+                record_reader(const std::string& d, size_t start = 0) : data(d), pos(start) {}
+
+                // Offset of the end of the last good record
+                size_t good_bytes() {
+                    return pos;
+                }
+
+                bool next(store_record& r) {
+                    size_t   p = pos;
+                    uint32_t size, sum;
+                    if (!get(data, p, data.size(), size) || !get(data, p, data.size(), sum)) return false;
+                    if ((size == 0) || (p + size > data.size()) || (checksum(data.data() + p, size) != sum)) return false;
+
+                    size_t end = p + size;
+                    r = store_record();
+                    r.type = (record_type) data[p++];
+
+                    bool ok = false;
+                    switch (r.type) {
+                        case CHARACTER_LOCATION:
+                            ok = get_str(p, end, r.name) && get_str(p, end, r.zone) && get_str(p, end, r.room);
+                            break;
+                        case CHARACTER_SAVED:
+                            ok = get_str(p, end, r.name);
+                            break;
+                        case WORLD_STATE: {
+                            uint8_t sun = 0, moon = 0;
+                            ok = get(data, p, end, r.tick) && get(data, p, end, sun) && get(data, p, end, moon);
+                            r.sun  = sun;
+                            r.moon = moon;
+                            break;
+                        }
+                    }
+                    if (!ok) return false;
+
+                    pos = end;
+                    return true;
+                }
+        };
+
+        // Change the saved world to match a record
+        void apply(const store_record& r) {
+            std::lock_guard<std::mutex> guard(state_lock);
+
+            switch (r.type) {
+                case CHARACTER_LOCATION:
+                    characters[r.name] = {r.zone, r.room};
+                    break;
+                case CHARACTER_SAVED:
+                    characters.erase(r.name);
+                    break;
+                case WORLD_STATE:
+                    saved_tick = r.tick;
+                    saved_sun  = r.sun;
+                    saved_moon = r.moon;
+                    break;
+            }
+        }
+
+        static bool read_file(const std::string& path, std::string& out) {
+            int fd = ::open(path.c_str(), O_RDONLY);
+            if (fd < 0) return false;
+
+            char buffer[65536];
+            ssize_t n;
+            while ((n = ::read(fd, buffer, sizeof(buffer))) > 0) {
+                out.append(buffer, n);
+            }
+            ::close(fd);
+            return n == 0;
+        }
+
+        static bool write_all(int fd, const std::string& data) {
+            size_t done = 0;
+            while (done < data.size()) {
+                ssize_t n = ::write(fd, data.data() + done, data.size() - done);
+                if (n < 0) {
+                    if (errno == EINTR) continue;
+                    return false;
+                }
+                done += n;
+            }
+            return true;
+        }
+
+        // Load the latest snapshot, then replay the log on top of it
+        bool recover() {
+            std::string snapshot;
+            size_t snapshot_records = 0;
+            size_t log_records = 0;
+
+            if (read_file(snapshot_path, snapshot)) {
+                size_t magic = std::strlen(SNAPSHOT_MAGIC);
+                if ((snapshot.size() < magic) || (snapshot.compare(0, magic, SNAPSHOT_MAGIC) != 0)) {
+                    std::cout << "Error - " << snapshot_path << " isn't a snapshot" << std::endl;
+                    return false;
+                }
+
+                record_reader reader(snapshot, magic);
+                store_record r;
+                while (reader.next(r)) {
+                    apply(r);
+                    snapshot_records++;
+                }
+
+                // The snapshot is written whole and renamed into place, so it should never be cut short
+                if (reader.good_bytes() != snapshot.size()) {
+                    std::cout << "Error - " << snapshot_path << " is corrupt" << std::endl;
+                    return false;
+                }
+            }
+
+            std::string log;
+            if (read_file(log_path, log)) {
+                record_reader reader(log);
+                store_record r;
+                while (reader.next(r)) {
+                    apply(r);
+                    log_records++;
+                }
+
+                // Anything after the last good record was being written when we went down - cut it off so new records follow good ones
+                log_bytes = reader.good_bytes();
+                if (log_bytes != log.size()) {
+                    std::cout << "world store:  dropping " << log.size() - log_bytes << " bytes of torn log" << std::endl;
+                    if (::truncate(log_path.c_str(), log_bytes) != 0) return false;
+                }
+            }
+
+            std::cout << "world store:  recovered " << snapshot_records << " snapshot records and " << log_records << " log records, "
+                      << characters.size() << " characters" << std::endl;
+            return true;
+        }
+
+        // Write the saved world out as a new snapshot, then start the log over
+        // (A crash between the two just means replaying records that are already in the snapshot)
+        bool snapshot() {
+            // Only this thread changes the saved world, so it can read it without taking state_lock
+            std::string out = SNAPSHOT_MAGIC;
+            store_record r;
+            for (std::pair<const std::string, saved_location>& c : characters) {
+                r.type = CHARACTER_LOCATION;
+                r.name = c.first;
+                r.zone = c.second.zone;
+                r.room = c.second.room;
+                encode(r, out);
+            }
+
+            r = store_record();
+            r.type = WORLD_STATE;
+            r.tick = saved_tick;
+            r.sun  = saved_sun;
+            r.moon = saved_moon;
+            encode(r, out);
+
+            std::string temp = snapshot_path + ".tmp";
+            int fd = ::open(temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            if (fd < 0) return false;
+            bool ok = write_all(fd, out) && (::fsync(fd) == 0);
+            ::close(fd);
+            if (!ok || (std::rename(temp.c_str(), snapshot_path.c_str()) != 0)) return false;
+
+            if (::ftruncate(log_fd, 0) != 0) return false;
+            log_bytes = 0;
+            last_snapshot = std::chrono::steady_clock::now();
+            snapshots_written++;
+            return true;
+        }
+
+        // The writer thread - write whatever has been queued as one batch, sync it, and compact the log when it's due
+        void run() {
+            std::vector<store_record> batch;
+            std::string               out;
+
+            while (true) {
+                bool stop;
+                {
+                    std::unique_lock<std::mutex> guard(queue_lock);
+                    wake.wait_for(guard, std::chrono::seconds(1), [this] { return stopping || !pending.empty(); });
+                    if (batch.empty()) {
+                        batch.swap(pending);
+                    }
+                    else {
+                        // The last batch couldn't be written, the new records go after it
+                        batch.insert(batch.end(), std::make_move_iterator(pending.begin()), std::make_move_iterator(pending.end()));
+                        pending.clear();
+                    }
+                    stop = stopping;
+                }
+
+                if (!batch.empty()) {
+                    out.clear();
+                    for (store_record& r : batch) {
+                        encode(r, out);
+                    }
+
+                    // Only what's safely in the log goes into the saved world (and so into the next snapshot) - if the write fails the
+                    // batch is kept and tried again, after cutting off whatever part of it made it into the log
+                    if (!write_all(log_fd, out) || (::fdatasync(log_fd) != 0)) {
+                        std::cout << "Error - Can't write to " << log_path << ":  " << std::strerror(errno) << ", " << batch.size()
+                                  << " records waiting" << (stop ? " are lost" : " to be written") << std::endl;
+                        if (::ftruncate(log_fd, log_bytes) != 0) {
+                            std::cout << "Error - Can't truncate " << log_path << ":  " << std::strerror(errno) << std::endl;
+                        }
+                    }
+                    else {
+                        log_bytes += out.size();
+
+                        for (store_record& r : batch) {
+                            apply(r);
+                        }
+                        records_written += batch.size();
+                        batch.clear();
+                    }
+                }
+
+                bool due = (log_bytes >= SNAPSHOT_LOG_BYTES) ||
+                           ((log_bytes > 0) && (std::chrono::steady_clock::now() - last_snapshot >= SNAPSHOT_INTERVAL));
+                if ((due || (stop && (log_bytes > 0))) && !snapshot()) {
+                    std::cout << "Error - Can't write the snapshot " << snapshot_path << ":  " << std::strerror(errno) << std::endl;
+                }
+
+                if (stop) break;
+            }
+        }
+
+        void queue(store_record&& r) {
+            {
+                std::lock_guard<std::mutex> guard(queue_lock);
+                pending.push_back(std::move(r));
+            }
+            wake.notify_one();
+        }
+
+    public:
+        world_store() {}
+
+        world_store(const world_store&) = delete;
+        world_store& operator= (const world_store&) = delete;
+
+        ~world_store() {
+            close();
+        }
+
+        // Recover the saved world from the directory (creating it if needed) and start the writer thread
+        bool open(const std::string& dir) {
+            if ((::mkdir(dir.c_str(), 0755) != 0) && (errno != EEXIST)) {
+                std::cout << "Error - Can't create " << dir << ":  " << std::strerror(errno) << std::endl;
+                return false;
+            }
+
+            log_path      = dir + "/world.log";
+            snapshot_path = dir + "/world.snapshot";
+
+            if (!recover()) return false;
+
+            log_fd = ::open(log_path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+            if (log_fd < 0) {
+                std::cout << "Error - Can't open " << log_path << ":  " << std::strerror(errno) << std::endl;
+                return false;
+            }
+
+            last_snapshot = std::chrono::steady_clock::now();
+            writer = std::thread([this] { run(); });
+            return true;
+        }
+
+        // Write out everything still queued, compact it into a snapshot and stop the writer thread
+        void close() {
+            if (!writer.joinable()) return;
+            {
+                std::lock_guard<std::mutex> guard(queue_lock);
+                stopping = true;
+            }
+            wake.notify_one();
+            writer.join();
+
+            ::close(log_fd);
+            log_fd = -1;
+        }
+
+        // These can be called from any strand - they only queue the record for the writer thread
+
+        void character_moved(std::string_view name, std::string_view zone, std::string_view room) {
+            store_record r;
+            r.type = CHARACTER_LOCATION;
+            r.name = name;
+            r.zone = zone;
+            r.room = room;
+            queue(std::move(r));
+        }
+
+        // Once a character's account has been saved with their location, the world doesn't need to keep it
+        void character_saved(std::string_view name) {
+            store_record r;
+            r.type = CHARACTER_SAVED;
+            r.name = name;
+            queue(std::move(r));
+        }
+
+        void world_state(uint64_t tick, bool sun, bool moon) {
+            store_record r;
+            r.type = WORLD_STATE;
+            r.tick = tick;
+            r.sun  = sun;
+            r.moon = moon;
+            queue(std::move(r));
+        }
+
+        // Where a character was last saved, returns false if they've never been saved
+        bool find_character(const std::string& name, saved_location& location) {
+            std::lock_guard<std::mutex> guard(state_lock);
+            std::unordered_map<std::string, saved_location>::iterator c = characters.find(name);
+            if (c == characters.end()) return false;
+            location = c->second;
+            return true;
+        }
+
+        void get_world_state(uint64_t& tick, bool& sun, bool& moon) {
+            std::lock_guard<std::mutex> guard(state_lock);
+            tick = saved_tick;
+            sun  = saved_sun;
+            moon = saved_moon;
+        }
+
+        uint64_t get_records_written() {
+            return records_written;
+        }
+
+        uint64_t get_snapshots_written() {
+            return snapshots_written;
+        }
+};
+
+}  // end namespace tbdmud
+
+#endif
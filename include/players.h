@@ -0,0 +1,401 @@
+// This file contains the player store - every player account, kept on disk and looked up by name at login
+// Accounts are appended to a data file, and a hash index on disk (keyed by the case-folded name) says where the latest copy
+// of each one is, so finding an account takes one read of the index and one read of the record however many accounts there are
+// The reads and writes run on the store's own threads, never on the world's strand
+
+#ifndef TBDMUD_PLAYERS_H_INCLUDED
+#define TBDMUD_PLAYERS_H_INCLUDED
+
+#include <iostream>
+#include <boost/asio.hpp>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <functional>
+#include <optional>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace tbdmud {
+
+struct player_account {
+    std::string name;                 // As they first typed it
+    std::string zone;                 // Where they were when the account was last saved
+    std::string room;
+    uint64_t    created    = 0;       // Unix time
+    uint64_t    last_login = 0;
+    uint32_t    logins     = 0;
+};
+
+// Case-fold a name the way the index and the login checks compare them
+inline std::string fold_name(std::string_view name) {
+    std::string folded(name);
+    for (char& c : folded) {
+        if ((c >= 'A') && (c <= 'Z')) c = c - 'A' + 'a';
+    }
+    return folded;
+}
+
+class player_store {
+    private:
+        static const uint64_t INDEX_MAGIC   = 0x3158444950444254ull;   // "TBDPIDX1"
+        static const uint64_t MIN_CAPACITY  = 1024;
+        static const size_t   RECORD_READ   = 256;     // Most records fit in one read of this size
+        static const size_t   PROBE_READ    = 8;       // Index slots read at a time while probing
+
+        // The index file is a header followed by a power-of-two table of slots, probed linearly
+        struct index_header {
+            uint64_t magic;
+            uint64_t capacity;
+            uint64_t count;
+            uint64_t data_bytes;       // How much of the data file the index covers
+        };
+
+        struct index_slot {
+            uint64_t hash;             // 0 = empty
+            uint64_t offset;           // Where the latest record for the name starts in the data file
+        };
+
+        std::string              data_path;
+        std::string              index_path;
+        int                      data_fd  = -1;
+        int                      index_fd = -1;
+        index_header             header = {};
+        std::shared_mutex        lock;                    // Loads share it, saves take it to themselves
+        boost::asio::thread_pool pool{2};                 // Where the disk reads and writes run
+
+        // FNV-1a - both to hash the folded name for the index, and to check records for corruption
+        static uint64_t hash64(const char* data, size_t size) {
+            uint64_t h = 14695981039346656037ull;
+            for (size_t i = 0; i < size; i++) {
+                h = (h ^ (unsigned char) data[i]) * 1099511628211ull;
+            }
+            return (h == 0) ? 1 : h;   // 0 marks an empty slot
+        }
+
+        static void put_str(std::string& out, const std::string& s) {
+            uint16_t n = s.size();
+            out.append(reinterpret_cast<const char*>(&n), sizeof(n));
+            out.append(s.data(), n);
+        }
+
+        template<typename T>
+        static void put(std::string& out, T v) {
+            out.append(reinterpret_cast<const char*>(&v), sizeof(v));
+        }
+
+        template<typename T>
+        static bool get(const std::string& in, size_t& p, T& v) {
+            if (p + sizeof(T) > in.size()) return false;
+            std::memcpy(&v, in.data() + p, sizeof(T));
+            p += sizeof(T);
+            return true;
+        }
+
+        static bool get_str(const std::string& in, size_t& p, std::string& s) {
+            uint16_t n;
+            if (!get(in, p, n) || (p + n > in.size())) return false;
+            s.assign(in.data() + p, n);
+            p += n;
+            return true;
+        }
+
+        // A record is [payload length][checksum of payload][payload]
+        static std::string encode(const player_account& a) {
+            std::string payload;
+            put_str(payload, a.name);
+            put_str(payload, a.zone);
+            put_str(payload, a.room);
+            put(payload, a.created);
+            put(payload, a.last_login);
+            put(payload, a.logins);
+
+            std::string out;
+            put(out, (uint32_t) payload.size());
+            put(out, (uint32_t) hash64(payload.data(), payload.size()));
+            return out + payload;
+        }
+
+        static bool decode(const std::string& payload, player_account& a) {
+            size_t p = 0;
+            return get_str(payload, p, a.name) && get_str(payload, p, a.zone) && get_str(payload, p, a.room) &&
+                   get(payload, p, a.created) && get(payload, p, a.last_login) && get(payload, p, a.logins);
+        }
+
+        static bool pread_all(int fd, char* buffer, size_t size, uint64_t offset) {
+            size_t done = 0;
+            while (done < size) {
+                ssize_t n = ::pread(fd, buffer + done, size - done, offset + done);
+                if (n < 0 && errno == EINTR) continue;
+                if (n <= 0) return false;
+                done += n;
+            }
+            return true;
+        }
+
+        static bool pwrite_all(int fd, const char* buffer, size_t size, uint64_t offset) {
+            size_t done = 0;
+            while (done < size) {
+                ssize_t n = ::pwrite(fd, buffer + done, size - done, offset + done);
+                if (n < 0 && errno == EINTR) continue;
+                if (n <= 0) return false;
+                done += n;
+            }
+            return true;
+        }
+
+        // Read the record at offset (usually in a single read), returns its total size or 0 if it's torn or corrupt
+        size_t read_record(uint64_t offset, player_account& a) {
+            char buffer[RECORD_READ];
+            ssize_t n = ::pread(data_fd, buffer, sizeof(buffer), offset);
+            if (n < 8) return 0;
+
+            uint32_t size, sum;
+            std::memcpy(&size, buffer, 4);
+            std::memcpy(&sum,  buffer + 4, 4);
+
+            std::string payload;
+            if (8 + (size_t) size <= (size_t) n) {
+                payload.assign(buffer + 8, size);
+            }
+            else {
+                payload.resize(size);
+                if (!pread_all(data_fd, &payload[0], size, offset + 8)) return 0;
+            }
+
+            if (((uint32_t) hash64(payload.data(), payload.size()) != sum) || !decode(payload, a)) return 0;
+            return 8 + size;
+        }
+
+        static uint64_t slot_offset(uint64_t i) {
+            return sizeof(index_header) + i * sizeof(index_slot);
+        }
+
+        // Find the slot for a folded name - where it is, or the empty slot where it would go
+        // Reads a few slots at a time, and checks the record's name when the hashes match (the only other read)
+        bool find_slot(const std::string& folded, uint64_t hash, uint64_t& slot, index_slot& found, player_account* account) {
+            uint64_t mask = header.capacity - 1;
+            uint64_t i = hash & mask;
+
+            for (uint64_t probed = 0; probed < header.capacity; ) {
+                index_slot slots[PROBE_READ];
+                uint64_t n = std::min<uint64_t>(PROBE_READ, header.capacity - i);   // Don't read past the end of the table
+                if (!pread_all(index_fd, reinterpret_cast<char*>(slots), n * sizeof(index_slot), slot_offset(i))) return false;
+
+                for (uint64_t k = 0; k < n; k++, probed++) {
+                    if (slots[k].hash == 0) {
+                        slot  = i + k;
+                        found = slots[k];
+                        return true;
+                    }
+                    if (slots[k].hash == hash) {
+                        player_account a;
+                        if (read_record(slots[k].offset, a) && (fold_name(a.name) == folded)) {
+                            slot  = i + k;
+                            found = slots[k];
+                            if (account != nullptr) *account = a;
+                            return true;
+                        }
+                    }
+                }
+                i = (i + n) & mask;
+            }
+
+            return false;  // Full (never happens, the table grows first)
+        }
+
+        bool write_header() {
+            return pwrite_all(index_fd, reinterpret_cast<const char*>(&header), sizeof(header), 0);
+        }
+
+        // Point the index at a record (written at offset) for the account
+        bool index_record(const player_account& a, uint64_t offset) {
+            std::string folded = fold_name(a.name);
+            uint64_t    hash   = hash64(folded.data(), folded.size());
+            uint64_t    slot;
+            index_slot  found;
+
+            if (!find_slot(folded, hash, slot, found, nullptr)) return false;
+
+            index_slot s = {hash, offset};
+            if (!pwrite_all(index_fd, reinterpret_cast<const char*>(&s), sizeof(s), slot_offset(slot))) return false;
+            if (found.hash == 0) header.count++;
+
+            // Keep the table under 70% full so probes stay short
+            if (header.count * 10 > header.capacity * 7) return grow();
+            return true;
+        }
+
+        // Rebuild the index at twice the size, from the slots of the current one
+        bool grow() {
+            std::vector<index_slot> slots(header.capacity);
+            if (!pread_all(index_fd, reinterpret_cast<char*>(slots.data()), slots.size() * sizeof(index_slot), slot_offset(0))) return false;
+
+            std::vector<index_slot> bigger(header.capacity * 2, index_slot{0, 0});
+            uint64_t mask = bigger.size() - 1;
+            for (index_slot& s : slots) {
+                if (s.hash == 0) continue;
+                uint64_t i = s.hash & mask;
+                while (bigger[i].hash != 0) i = (i + 1) & mask;
+                bigger[i] = s;
+            }
+
+            header.capacity = bigger.size();
+            return write_index(bigger);
+        }
+
+        // Write a whole new index file and swap it in
+        bool write_index(const std::vector<index_slot>& slots) {
+            std::string temp = index_path + ".tmp";
+            int fd = ::open(temp.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+            if (fd < 0) return false;
+
+            bool ok = pwrite_all(fd, reinterpret_cast<const char*>(&header), sizeof(header), 0) &&
+                      pwrite_all(fd, reinterpret_cast<const char*>(slots.data()), slots.size() * sizeof(index_slot), sizeof(header)) &&
+                      (::fsync(fd) == 0) && (std::rename(temp.c_str(), index_path.c_str()) == 0);
+            if (!ok) {
+                ::close(fd);
+                return false;
+            }
+
+            if (index_fd >= 0) ::close(index_fd);
+            index_fd = fd;
+            return true;
+        }
+
+        // Index the records the index doesn't cover yet (all of them, if the index is new), and cut off a torn record at the end
+        bool catch_up(uint64_t data_size) {
+            uint64_t offset  = header.data_bytes;
+            uint64_t records = 0;
+
+            while (offset < data_size) {
+                player_account a;
+                size_t n = read_record(offset, a);
+                if (n == 0) break;
+                if (!index_record(a, offset)) return false;
+                offset += n;
+                records++;
+            }
+
+            if (offset < data_size) {
+                std::cout << "player store:  dropping " << data_size - offset << " bytes of torn record" << std::endl;
+                if (::ftruncate(data_fd, offset) != 0) return false;
+            }
+
+            if (records > 0) std::cout << "player store:  indexed " << records << " records the index was missing" << std::endl;
+            header.data_bytes = offset;
+            return write_header();
+        }
+
+    public:
+        player_store() {}
+
+        player_store(const player_store&) = delete;
+        player_store& operator= (const player_store&) = delete;
+
+        ~player_store() {
+            close();
+        }
+
+        // Open (or create) the store in the directory
+        bool open(const std::string& dir) {
+            if ((::mkdir(dir.c_str(), 0755) != 0) && (errno != EEXIST)) {
+                std::cout << "Error - Can't create " << dir << ":  " << std::strerror(errno) << std::endl;
+                return false;
+            }
+
+            data_path  = dir + "/players.dat";
+            index_path = dir + "/players.idx";
+
+            data_fd = ::open(data_path.c_str(), O_RDWR | O_CREAT, 0644);
+            if (data_fd < 0) {
+                std::cout << "Error - Can't open " << data_path << ":  " << std::strerror(errno) << std::endl;
+                return false;
+            }
+
+            struct stat st;
+            fstat(data_fd, &st);
+
+            // Use the index if it's good, otherwise build a new one from the data file
+            index_fd = ::open(index_path.c_str(), O_RDWR);
+            bool good = (index_fd >= 0) && pread_all(index_fd, reinterpret_cast<char*>(&header), sizeof(header), 0) &&
+                        (header.magic == INDEX_MAGIC) && (header.capacity >= MIN_CAPACITY) && ((header.capacity & (header.capacity - 1)) == 0) &&
+                        (header.data_bytes <= (uint64_t) st.st_size);
+            if (!good) {
+                if (index_fd >= 0) std::cout << "player store:  rebuilding " << index_path << std::endl;
+                header = {INDEX_MAGIC, MIN_CAPACITY, 0, 0};
+                if (!write_index(std::vector<index_slot>(MIN_CAPACITY, index_slot{0, 0}))) {
+                    std::cout << "Error - Can't write " << index_path << ":  " << std::strerror(errno) << std::endl;
+                    return false;
+                }
+            }
+
+            if (!catch_up(st.st_size)) {
+                std::cout << "Error - Can't index " << data_path << ":  " << std::strerror(errno) << std::endl;
+                return false;
+            }
+
+            std::cout << "player store:  " << header.count << " accounts" << std::endl;
+            return true;
+        }
+
+        // Wait for the reads and writes in progress, then close the files
+        void close() {
+            pool.join();
+            if (data_fd  >= 0) ::close(data_fd);
+            if (index_fd >= 0) ::close(index_fd);
+            data_fd  = -1;
+            index_fd = -1;
+        }
+
+        // Look an account up by name (any case), on the store's threads
+        // done is called there too, with the account if there is one
+        void load(std::string name, std::function<void(std::optional<player_account>)> done) {
+            boost::asio::post(pool, [this, name = std::move(name), done = std::move(done)] {
+                std::optional<player_account> result;
+                {
+                    std::shared_lock<std::shared_mutex> guard(lock);
+                    std::string    folded = fold_name(name);
+                    uint64_t       hash   = hash64(folded.data(), folded.size());
+                    uint64_t       slot;
+                    index_slot     found;
+                    player_account a;
+
+                    if (find_slot(folded, hash, slot, found, &a) && (found.hash != 0)) result = a;
+                }
+                done(result);
+            });
+        }
+
+        // Append the account's latest copy and point the index at it, on the store's threads
+        void save(player_account account, std::function<void()> done = nullptr) {
+            boost::asio::post(pool, [this, account = std::move(account), done = std::move(done)] {
+                {
+                    std::unique_lock<std::shared_mutex> guard(lock);
+                    std::string record = encode(account);
+                    uint64_t    offset = header.data_bytes;
+
+                    // The record is synced before the index points at it, and the header last, so a crash can only lose the newest save
+                    bool ok = pwrite_all(data_fd, record.data(), record.size(), offset) && (::fdatasync(data_fd) == 0) &&
+                              index_record(account, offset);
+                    if (ok) {
+                        header.data_bytes = offset + record.size();
+                        ok = write_header();
+                    }
+                    if (!ok) {
+                        std::cout << "Error - Can't save player " << account.name << ":  " << std::strerror(errno) << std::endl;
+                    }
+                }
+                if (done) done();
+            });
+        }
+};
+
+}  // end namespace tbdmud
+
+#endif
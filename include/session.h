@@ -5,135 +5,254 @@
 #include <boost/asio.hpp>
 #include <boost/bind/bind.hpp>
 #include <boost/algorithm/string.hpp>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstring>
 #include <string>
+#include <string_view>
 #include <queue>
 #include <vector>
+#include <zlib.h>
 #include <entities.h>
+#include <metrics.h>
+#include <telnet.h>
+#include <copyover.h>
 
 namespace io = boost::asio;
 using tcp = io::ip::tcp;
 using error_code = boost::system::error_code;
 
-using command_handler = std::function<void (std::string)>;
+class session;
+
+using command_handler = std::function<void (std::string, std::chrono::steady_clock::time_point)>;   // Called with each line and when it was read
 using error_handler = std::function<void ()>;
+using login_handler = std::function<void (std::shared_ptr<session>, std::string)>;   // Called with the username the client asked for
+
+// An immutable, reference-counted message - a broadcast is rendered once and every recipient's queue holds a reference to it
+using shared_buffer = std::shared_ptr<const std::string>;
+
+inline shared_buffer make_buffer(std::string message) {
+    return std::make_shared<const std::string>(std::move(message));
+}
+
+// What to do when a session's outbound queue goes over its soft limits
+enum overflow_policy {
+    DROP_OLDEST,      // Drop the oldest non-critical messages until we're back under the limits
+    COLLAPSE,         // Drop them the same way, but leave a "[N messages skipped]" marker in their place
+    DISCONNECT        // Close the session
+};
+
+// Limits on how much can pile up for a client that isn't reading what we send
+struct outbound_limits {
+    size_t          max_bytes    = 256 * 1024;          // Soft limits - the policy kicks in above either of these
+    size_t          max_messages = 1024;
+    size_t          hard_bytes   = 4 * 1024 * 1024;     // Past this (counting critical messages) the session is disconnected whatever the policy
+    overflow_policy policy       = COLLAPSE;
+};
+
+// The policy by the name it's given on the command line (drop, collapse or disconnect), false if there isn't one by that name
+inline bool parse_overflow_policy(std::string_view name, overflow_policy& policy) {
+    if (name == "drop") policy = DROP_OLDEST;
+    else if (name == "collapse") policy = COLLAPSE;
+    else if (name == "disconnect") policy = DISCONNECT;
+    else return false;
+    return true;
+}
+
+// A message waiting to be written to a client
+struct outbound_message {
+    shared_buffer buffer;
+    bool          critical = false;   // Critical messages (prompts, replies to the client's own commands) are never dropped
+    size_t        skipped  = 0;       // Non-zero if this is a "[N messages skipped]" marker
+    bool          starts_compression = false;   // The MCCP2 start sequence - everything after it is compressed
+};
 
 // Create shared-pointer session objects for each connected client
+// The socket's executor is a strand for this session, so all of its socket handlers run one at a time,
+// and messages posted from the world's strand are handed over to it before touching the outgoing queue
+// (The player is only touched on the world's strand)
 class session : public std::enable_shared_from_this<session>
 {
 private:
     tcp::socket socket;                          // The socket for this client
-    io::streambuf streambuf;                     // Incoming data
-    std::queue<std::string> outgoing;            // Outgoing messages
+    std::array<char, 4096> read_buffer;          // Incoming data, as it came off the socket (reused for every read)
+    size_t read_start = 0;                       // The part of read_buffer that hasn't been through the telnet parser yet
+    size_t read_end = 0;
+    std::chrono::steady_clock::time_point received;   // When the data in read_buffer was read (command latency is timed from here)
+    tbdmud::telnet_parser telnet;                // Splits the input into lines and answers the client's option negotiation
+    enum {
+        USERNAME,                                // The next line is the name they want to log in as
+        LOGGING_IN,                              // The server is checking the name, so leave any input that's already here until it answers
+        PLAYING                                  // Lines are commands
+    } input_state = USERNAME;
+    std::deque<outbound_message> outgoing;       // Outgoing messages
+    std::vector<io::const_buffer> gathered;      // The buffer sequence for the write in flight (reused between writes)
+    size_t in_flight = 0;                        // Number of messages at the front of outgoing that are being written
+    size_t in_flight_bytes = 0;                  // Their size before compression
+    size_t queued_bytes = 0;                     // Total size of the messages in outgoing
+    size_t queued_droppable = 0;                 // Messages in outgoing that could be dropped (non-critical, not markers)
+    size_t in_flight_droppable = 0;              // The ones among them being written, which can't be
+    bool write_scheduled = false;                // A write has been posted to start once the handler queuing messages has finished
+    outbound_limits limits;
+    bool closing = false;                        // Set once we've decided to drop this client, so nothing more gets queued
+    bool input_held = false;                     // A copyover is coming - leave what's read for the new server, and read no more
+    bool output_held = false;                    // A copyover is about to happen - start no more writes
+    std::atomic<bool> quiet{false};              // Output is held and no write is in flight, so the connection can be handed over
+    std::string unsent;                          // The part of a compressed write that was cut short by holding the output, still owed to the client
+    std::atomic<uint64_t> dropped_bytes{0};      // Bytes this session has dropped because the client wasn't keeping up
+    std::atomic<uint64_t> dropped_messages{0};
+    std::atomic<uint64_t> bytes_written{0};      // Everything this session has sent the client
+    std::atomic<int64_t>  reported_messages{0};  // The queue as last added into the server-wide gauges
+    std::atomic<int64_t>  reported_bytes{0};
+    enum {
+        UNCOMPRESSED,
+        COMPRESSION_STARTING,                    // The client agreed to MCCP2, the start sequence is queued
+        COMPRESSED
+    } compression = UNCOMPRESSED;
+    int compression_level = 0;                   // zlib's 1-9, 0 if we don't offer MCCP2 to this client
+    z_stream deflater;                           // Only set up once the client agrees to compression, so clients that don't pay nothing for it
+    std::vector<char> compressed;                // The compressed write in flight (reused between writes)
     command_handler on_command;                  // Client command handler
     error_handler   on_error;                    // Client error handler
+    login_handler   on_login;                    // Server handler that checks the username and creates the player and character
     uint session_id = 0;
+    std::string ip_address;                      // The client's address, grabbed when they log in
+    int         port = 0;
     std::shared_ptr<tbdmud::player>  player;     // Once a client has been authenticated they will populate the player data from file
-                                                 // This session creates the player object, but the server will own it
-    std::function<std::shared_ptr<tbdmud::character>(session*, std::string)> create_character;  // A function pointer to the world's create_character function to pass to session objects
-    std::function<bool(std::string)> does_player_exist;  // A function pointer to the server's does_player_exist function to pass to session objects
-    //std::function<void(session*, std::shared_ptr<tbdmud::character>)> register_character;  // A function pointer to the world's register_character function to pass to session objects
+                                                 // The server creates the player object and owns it
 
     void async_login_username() {
         const std::string login_prompt = "Enter username: --> ";
 
         post(login_prompt);
-        io::async_read_until(socket, streambuf, "\n", [self = shared_from_this()] (error_code error, std::size_t bytes_transferred)
-        {
-            self->on_username(error, bytes_transferred);
-        });
+        input_state = USERNAME;
+        process_input();   // They may have typed ahead
     }
 
-    // Asynchronously receive data from the TCP socket
+    // Asynchronously receive whatever data the client sends next
+    // Capture self's shared pointer into the completion handler's lambda to keep the session object alive until the handler is invoked
     void async_read()
     {
-        // Continue reading from the socket until we encounter a Return key
-        // Pass in the receive buffer and a function to run afterwards to process intputs and handle errors
-        // Capture self's shared pointer into the completion handler's lambda to keep the session object alive until the handler is invoked
-        io::async_read_until(socket, streambuf, "\n", [self = shared_from_this()] (error_code error, std::size_t bytes_transferred)
+        socket.async_read_some(io::buffer(read_buffer), [self = shared_from_this()] (error_code error, std::size_t bytes_transferred)
         {
             self->on_read(error, bytes_transferred);
         });
     }
 
-    // Validate user login and create the player object
-    void on_username(error_code error, std::size_t bytes_transferred) {
-        const std::string delimiters = ": ";
-        std::vector<std::string> substrings;
-        
+    // Call the command or error handlers depending on input
+    void on_read(error_code error, std::size_t bytes_transferred)
+    {
         if(!error)
         {
-            // Create a message from received data, call the message handler
-            std::stringstream username;
-            std::stringstream client_ip;
-
-            client_ip << socket.remote_endpoint(error);    // Grab and store the client's IP address and port
-            username << std::istream(&streambuf).rdbuf();  // Grab the name input from the connected client
-            streambuf.consume(bytes_transferred);
-
-            // Check if we already have a player logged in with that name
-            std::string playername = username.str();
-            playername.pop_back();  // Remove the LF that comes with the line
-            playername.pop_back();  // Remove the CR that comes with the line
-
-            #ifdef DEBUG
-            std::cout << "session:: Checking to see if player " << username.str() << "exists" << std::endl;
-            #endif
-            if (does_player_exist(playername)) {
-                const std::string prompt = "\n" + playername + " is already in use\n";
-                post(prompt);
-                async_login_username(); // Register this routine to run again instead of async_read()
-                return;
-            }
-
-            boost::split(substrings, client_ip.str(), boost::is_any_of(delimiters), boost::token_compress_on);  // Split the IP address and port
-
-            // This session creates the player object, but the server will own it
-            player = std::shared_ptr<tbdmud::player>(new tbdmud::player(username.str(), session_id, true, substrings[0], std::stoi(substrings[1])));
-            
-            std::cout << "User " << player->get_name() << " has connected from " << player->get_ip() << ":" << player->get_port() << std::endl << std::endl;
-            post("User " + player->get_name() + " has connected.\n");
-
-            std::cout << "Session->Creating new character " << player->get_name() << std::endl;
-            //register_character(this, player->get_character());
-            player->set_character(create_character(this, player->get_name()));
-
-            async_read();               // Start handling asynchronous command inputs
+            received   = std::chrono::steady_clock::now();
+            read_start = 0;
+            read_end   = bytes_transferred;
+            process_input();
+        }
+        else if (output_held && (error == io::error::operation_aborted))
+        {
+            // Cancelled for a copyover - nothing was read
         }
         else
         {
             // Call the error handler, then exit
-            player->set_connected(false);
             socket.close(error);
-            on_error();
+            closed();
         }
     }
 
-    // Call the command or error handlers depending on input
-    void on_read(error_code error, std::size_t bytes_transferred)
+    // The socket failed (or was closed) - tell the server once, and let go of the handlers
+    // (The server's handlers hold a reference to this session, so until they're gone it would never be freed)
+    void closed()
     {
-        if(!error)
-        {
-            std::stringstream line;
-            //line << player->username << ":  " << std::istream(&streambuf).rdbuf();
-            line << std::istream(&streambuf).rdbuf();
-            streambuf.consume(bytes_transferred);
+        error_handler handler = std::move(on_error);
+        on_error   = nullptr;
+        on_command = nullptr;
+        if (handler) handler();
+    }
+
+    // Run what's been read through the telnet parser, handing each line on as it's completed, then read some more
+    // (While the server checks a username the rest is left in the buffer, and this is called again when it answers)
+    void process_input()
+    {
+        if (!on_error) return;   // Closed while the server was checking their name
+        if (input_held) return;  // Whatever's left goes to the new server with the connection
+
+        while (read_start < read_end) {
+            read_start += telnet.parse(read_buffer.data() + read_start, read_end - read_start);
 
-            on_command(line.str());     // Pass the received line string to the command handler to decode commands and create events
-            async_read();               // Recursive call to do the next read
+            // Negotiation is answered straight away, it doesn't go through the world
+            if (telnet.has_replies()) {
+                queue_message(make_buffer(telnet.take_replies()), true);
+            }
+
+            // The client agreed to MCCP2
+            if ((compression == UNCOMPRESSED) && telnet.is_local_enabled(tbdmud::telnet::OPT_COMPRESS2)) {
+                begin_compression();
+            }
+
+            if (!telnet.line_ready()) continue;
+
+            if (input_state == USERNAME) {
+                if (on_username(telnet.get_line())) return;
+            }
+            else if (!telnet.get_line().empty()) {
+                on_command(std::string(telnet.get_line()), received);  // Pass the line to the command handler (its own copy, it's going to another strand)
+            }
         }
-        else
-        {
-            // Call the error handler, then exit
-            socket.close(error);
-            on_error();
+
+        async_read();
+    }
+
+    // Hand the username to the server, which creates the player object if it's free
+    // Returns true if it was handed on (and reading waits for the answer), false if there wasn't a name in the line
+    bool on_username(std::string_view line) {
+        error_code error;
+
+        size_t first = line.find_first_not_of(" \t");
+        if (first == std::string_view::npos) return false;   // Just Enter, keep waiting for a name
+        std::string playername(line.substr(first, line.find_last_not_of(" \t") - first + 1));
+
+        tcp::endpoint remote = socket.remote_endpoint(error);   // Grab and store the client's IP address and port
+        if (!error) {
+            ip_address = remote.address().to_string();
+            port       = remote.port();
         }
+
+        // The server checks if we already have a player logged in with that name, and calls login_accepted() or login_rejected()
+        #ifdef DEBUG
+        std::cout << "session:: Checking to see if player " << playername << " exists" << std::endl;
+        #endif
+        input_state = LOGGING_IN;
+        on_login(shared_from_this(), playername);
+        return true;
     }
 
     // Write the current contents of the outgoing buffer to the socket
+    // Every queued message is gathered into one buffer sequence, so they go out in a single write (writev) instead of one at a time
     void async_write()
     {
-        // Pass in the front of the message queue and a function to run afterwards to clean up and handle errors
-        io::async_write(socket, io::buffer(outgoing.front()), [self = shared_from_this()] (error_code error, std::size_t bytes_transferred)
+        gathered.clear();
+        in_flight           = 0;
+        in_flight_bytes     = 0;
+        in_flight_droppable = 0;
+        for (const outbound_message& message : outgoing) {
+            in_flight++;
+            in_flight_bytes += message.buffer->size();
+            if (droppable(message)) in_flight_droppable++;
+            if (compression != COMPRESSED) gathered.push_back(io::buffer(*message.buffer));
+            if (message.starts_compression) break;   // The start sequence has to reach the client before the first compressed byte
+        }
+
+        // Compressed, the gathered messages become one block of the session's zlib stream
+        if (compression == COMPRESSED) {
+            deflate_in_flight();
+            gathered.push_back(io::buffer(compressed));
+        }
+
+        // Pass in the gathered messages and a function to run afterwards to clean up and handle errors
+        io::async_write(socket, gathered, [self = shared_from_this()] (error_code error, std::size_t bytes_transferred)
         {
             self->on_write(error, bytes_transferred);
         });
@@ -144,29 +263,288 @@ private:
     {
         if(!error)
         {
-            outgoing.pop();
+            if (outgoing[in_flight - 1].starts_compression) start_compression();
 
-            // Do a write if we still have messages in the queue
-            if(!outgoing.empty())
+            pop_sent(in_flight);
+            queued_bytes -= in_flight_bytes;
+            in_flight = 0;
+            bytes_written += bytes_transferred;
+            stats().bytes_written.add(bytes_transferred);
+            report_queue();
+
+            // Do a write if more messages were queued while that one was in flight
+            if (output_held)
+            {
+                quiet = true;
+            }
+            else if(!outgoing.empty())
             {
                 async_write();
             }
         }
+        else if (output_held && (error == io::error::operation_aborted))
+        {
+            keep_unsent(bytes_transferred);
+            quiet = true;
+        }
         else
         {
             socket.close(error);
-            on_error();
+            closed();
         }
     }
 
-public:
+    // A write was cut short for a copyover - take what was sent off the queue, so the rest is handed over without repeating any of it
+    void keep_unsent(size_t sent)
+    {
+        bytes_written += sent;
+        stats().bytes_written.add(sent);
+
+        if (compression == COMPRESSED) {
+            // The messages are all in the compressed block - what's left of it goes to the client as it is, ahead of the queue
+            unsent.assign(compressed.data() + sent, compressed.size() - sent);
+            pop_sent(in_flight);
+            queued_bytes -= in_flight_bytes;
+        }
+        else {
+            // Messages sent whole come off the queue, the one that was cut short keeps what's left of it
+            size_t whole = 0;
+            while ((whole < in_flight) && (sent >= outgoing[whole].buffer->size())) {
+                sent         -= outgoing[whole].buffer->size();
+                queued_bytes -= outgoing[whole].buffer->size();
+                if (outgoing[whole].starts_compression) start_compression();
+                whole++;
+            }
+            pop_sent(whole);
+
+            // The rest of a message the client has started getting can't be dropped, or they'd see half of it
+            if (sent > 0) {
+                if (droppable(outgoing.front())) queued_droppable--;
+                outgoing.front().buffer   = make_buffer(outgoing.front().buffer->substr(sent));
+                outgoing.front().critical = true;
+                queued_bytes -= sent;
+            }
+        }
+
+        in_flight = 0;
+        in_flight_droppable = 0;
+        report_queue();
+    }
+
+    // What's already queued goes out as it is, everything after the start sequence is compressed
+    void begin_compression() {
+        compression = COMPRESSION_STARTING;
+        queue_message(make_buffer(std::string{(char) tbdmud::telnet::IAC, (char) tbdmud::telnet::SB, (char) tbdmud::telnet::OPT_COMPRESS2,
+                                              (char) tbdmud::telnet::IAC, (char) tbdmud::telnet::SE}), true, true);
+    }
+
+    // The start sequence has been written, so from here on everything is compressed
+    void start_compression() {
+        // A smaller window and less memory than zlib's defaults, so a deflate stream is about 64k a session instead of 256k
+        // (The client inflates it with whatever window it's given)
+        deflater = z_stream{};
+        if (deflateInit2(&deflater, compression_level, Z_DEFLATED, 13, 6, Z_DEFAULT_STRATEGY) != Z_OK) {
+            disconnect("can't start compression");
+            return;
+        }
+        compression = COMPRESSED;
+        stats().compressed_sessions.add(1);
+    }
+
+    // Compress the messages that are about to be written into compressed, flushed so the client can show them straight away
+    void deflate_in_flight() {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        size_t used = 0;
+
+        compressed.resize(compressed.capacity());
+        for (size_t i = 0; i < in_flight; i++) {
+            const std::string& message = *outgoing[i].buffer;
+            deflater.next_in  = (Bytef*) message.data();
+            deflater.avail_in = message.size();
+
+            // Keep going until zlib has room left over, which means it's taken all the input (and flushed, on the last message)
+            do {
+                if (used == compressed.size()) compressed.resize(std::max<size_t>(4096, compressed.size() * 2));
+                deflater.next_out  = (Bytef*) compressed.data() + used;
+                deflater.avail_out = compressed.size() - used;
+                deflate(&deflater, (i + 1 == in_flight) ? Z_SYNC_FLUSH : Z_NO_FLUSH);
+                used = compressed.size() - deflater.avail_out;
+            } while (deflater.avail_out == 0);
+        }
+
+        compressed.resize(used);   // Only shrinks it, so the capacity is kept for the next write
+        stats().compression_in.add(in_flight_bytes);
+        stats().compression_out.add(used);
+        stats().compression_time.record(std::chrono::steady_clock::now() - start);
+    }
+
+    // Compress some text onto the end of out (for a copyover, where the output is handed over instead of written)
+    void deflate_onto(std::string& out, const std::string& text, int flush) {
+        char chunk[4096];
+
+        deflater.next_in  = (Bytef*) text.data();
+        deflater.avail_in = text.size();
+        do {
+            deflater.next_out  = (Bytef*) chunk;
+            deflater.avail_out = sizeof(chunk);
+            deflate(&deflater, flush);
+            out.append(chunk, sizeof(chunk) - deflater.avail_out);
+        } while (deflater.avail_out == 0);
+    }
+
+    // End the compressed stream onto the end of out, so the client goes back to plain text (for a copyover)
+    void finish_compression(std::string& out) {
+        deflate_onto(out, std::string(), Z_FINISH);
+        deflateEnd(&deflater);
+        compression = UNCOMPRESSED;
+        stats().compressed_sessions.add(-1);
+    }
+
+    // Only non-critical messages can be dropped - a skip marker stays, so the client knows
+    static bool droppable(const outbound_message& message) {
+        return !message.critical && (message.skipped == 0);
+    }
+
+    // Take the first n messages off the queue once they've been sent
+    void pop_sent(size_t n) {
+        for (size_t i = 0; i < n; i++) {
+            if (droppable(outgoing[i])) queued_droppable--;
+        }
+        outgoing.erase(outgoing.begin(), outgoing.begin() + n);
+    }
+
+    // Drop the oldest non-critical messages that aren't already being written, until the queue is back down to 3/4 of the soft limits
+    // (Going below the limits means a client that stays stalled only gets trimmed every so often rather than on every message)
+    // The walk stops once there's nothing left to drop, so a queue that's all critical isn't scanned for every message added to it
+    // Returns the number of messages dropped
+    size_t drop_oldest() {
+        size_t target_bytes    = limits.max_bytes / 4 * 3;
+        size_t target_messages = limits.max_messages / 4 * 3;
+        size_t available       = queued_droppable - ((in_flight > 0) ? in_flight_droppable : 0);
+        size_t dropped = 0;
+
+        if (available == 0) return 0;
+
+        std::deque<outbound_message>::iterator m = outgoing.begin() + in_flight;
+        while ((m != outgoing.end()) && (dropped < available) && ((queued_bytes > target_bytes) || (outgoing.size() - dropped > target_messages))) {
+            if (droppable(*m)) {
+                queued_bytes -= m->buffer->size();
+                dropped_bytes += m->buffer->size();
+                stats().dropped_bytes.add(m->buffer->size());
+                dropped++;
+                m->buffer = nullptr;
+            }
+            m++;
+        }
+
+        if (dropped > 0) {
+            outgoing.erase(std::remove_if(outgoing.begin() + in_flight, outgoing.end(), [] (const outbound_message& om) { return om.buffer == nullptr; }), outgoing.end());
+        }
+
+        queued_droppable -= dropped;
+        dropped_messages += dropped;
+        stats().dropped_messages.add(dropped);
+        return dropped;
+    }
+
+    // Apply the overflow policy once the outgoing queue is over its limits
+    void enforce_limits() {
+        size_t dropped;
+
+        if (queued_bytes > limits.hard_bytes) {
+            disconnect("outbound queue over hard limit");
+            return;
+        }
+
+        if ((queued_bytes <= limits.max_bytes) && (outgoing.size() <= limits.max_messages)) return;
+
+        switch (limits.policy) {
+            case DROP_OLDEST:
+                drop_oldest();
+                break;
+            case COLLAPSE:
+                dropped = drop_oldest();
+                if (dropped > 0) {
+                    // Fold the count into a marker that is still waiting to be sent, or add one in front of the unsent messages
+                    std::deque<outbound_message>::iterator marker = outgoing.begin() + in_flight;
+                    if ((marker == outgoing.end()) || (marker->skipped == 0)) {
+                        marker = outgoing.insert(marker, outbound_message{nullptr, false, 0});
+                    }
+                    else {
+                        queued_bytes -= marker->buffer->size();
+                    }
+
+                    marker->skipped += dropped;
+                    marker->buffer = make_buffer("\n[" + std::to_string(marker->skipped) + " messages skipped]\n");
+                    queued_bytes += marker->buffer->size();
+                }
+                break;
+            case DISCONNECT:
+                disconnect("outbound queue over limit");
+                break;
+        }
+    }
+
+    // The metrics every session adds into
+    struct session_metrics {
+        tbdmud::counter&   bytes_written  = tbdmud::metrics().get_counter("tbdmud_session_bytes_written_total", "Bytes written to clients");
+        tbdmud::gauge&     queued_messages = tbdmud::metrics().get_gauge("tbdmud_outbound_queued_messages", "Messages waiting to be written, across all sessions");
+        tbdmud::gauge&     queued_bytes   = tbdmud::metrics().get_gauge("tbdmud_outbound_queued_bytes", "Bytes waiting to be written, across all sessions");
+        tbdmud::histogram& queue_depth    = tbdmud::metrics().get_histogram("tbdmud_outbound_queue_depth_messages", "A session's outbound queue length, each time a message is queued");
+        tbdmud::counter&   dropped_bytes  = tbdmud::metrics().get_counter("tbdmud_outbound_dropped_bytes_total", "Bytes dropped from outbound queues because the client wasn't keeping up");
+        tbdmud::counter&   dropped_messages = tbdmud::metrics().get_counter("tbdmud_outbound_dropped_messages_total", "Messages dropped from outbound queues because the client wasn't keeping up");
+        tbdmud::gauge&     compressed_sessions = tbdmud::metrics().get_gauge("tbdmud_mccp_sessions", "Sessions with MCCP2 compression on");
+        tbdmud::counter&   compression_in   = tbdmud::metrics().get_counter("tbdmud_mccp_input_bytes_total", "Bytes compressed for MCCP2 sessions, before compression");
+        tbdmud::counter&   compression_out  = tbdmud::metrics().get_counter("tbdmud_mccp_output_bytes_total", "Bytes compressed for MCCP2 sessions, after compression");
+        tbdmud::histogram& compression_time = tbdmud::metrics().get_histogram("tbdmud_mccp_deflate_seconds", "Time spent compressing each write for MCCP2 sessions", 1e-9);
+    };
+
+    static session_metrics& stats() {
+        static session_metrics m;
+        return m;
+    }
+
+    // Bring the server-wide queue gauges up to date with this session's queue (on this session's strand)
+    void report_queue() {
+        int64_t messages = outgoing.size();
+        int64_t bytes    = queued_bytes;
+        stats().queued_messages.add(messages - reported_messages.exchange(messages));
+        stats().queued_bytes.add(bytes - reported_bytes.exchange(bytes));
+    }
 
-    // Constructor - initialize our internal socket from the passed-in socket
-    session(tcp::socket&& socket, uint sid, std::function<std::shared_ptr<tbdmud::character>(session*, std::string)> cc, std::function<bool(std::string)> dpe)  : socket(std::move(socket))
+    // Close the socket - the outstanding read (and write) will then fail and call the error handler
+    // (We don't call it directly, since we may be in the middle of the world iterating over the sessions)
+    void disconnect(const std::string& reason) {
+        error_code error;
+
+        std::cout << "session " << session_id << ":  disconnecting, " << reason << " (" << queued_bytes << " bytes queued)" << std::endl;
+        closing = true;
+        dropped_bytes += queued_bytes;
+        stats().dropped_bytes.add(queued_bytes);
+        socket.close(error);
+    }
+
+public:
+    // Constructor - initialize our internal socket from the passed-in socket (which should have been opened on a strand)
+    session(tcp::socket&& socket, uint sid, login_handler login)  : socket(std::move(socket))
     {
+        error_code error;
+
         session_id = sid;
-        create_character = cc;
-        does_player_exist = dpe;
+        on_login = login;
+        this->socket.set_option(tcp::no_delay(true), error);   // Each write is a whole reply, so don't let Nagle hold it back waiting for an ACK
+    }
+
+    // Whatever was still queued isn't waiting any more
+    ~session()
+    {
+        stats().queued_messages.add(-reported_messages);
+        stats().queued_bytes.add(-reported_bytes);
+
+        if (compression == COMPRESSED) {
+            deflateEnd(&deflater);
+            stats().compressed_sessions.add(-1);
+        }
     }
 
     // Register the passed-in message and error handler functions to the session object, start asynchronous socket reads
@@ -174,32 +552,236 @@ public:
     {
         this->on_command = std::move(on_command);
         this->on_error = std::move(on_error);
-        
-        // Call async_login_username() first, then async_login_username() will asynchronously call the command handler by calling async_read()
-        async_login_username();
+
+        // Ask for the client's window size and terminal type (if it's a telnet client it can tell us) and offer to compress what we send,
+        // then ask for their username - the lines after the username go to the command handler
+        io::dispatch(socket.get_executor(), [self = shared_from_this()] {
+            self->telnet.request_remote(tbdmud::telnet::OPT_NAWS);
+            self->telnet.request_remote(tbdmud::telnet::OPT_TTYPE);
+            if (self->compression_level > 0) self->telnet.request_local(tbdmud::telnet::OPT_COMPRESS2);
+            self->queue_message(make_buffer(self->telnet.take_replies()), true);
+            self->async_login_username();
+        });
+    }
+
+    // Copyover, first step - stop handling input, what's been read but not handled is handed over with the connection
+    void hold_input()
+    {
+        io::dispatch(socket.get_executor(), [self = shared_from_this()] { self->input_held = true; });
+    }
+
+    // Second step, once the output has had a moment to drain - start no more writes, and cut short one that's still going
+    // (How much of it was sent is known when it's cancelled, so the rest is handed over without repeating or losing any of it)
+    // is_quiet() turns true once there's nothing in flight
+    void hold_output()
+    {
+        io::dispatch(socket.get_executor(), [self = shared_from_this()] {
+            error_code error;
+
+            self->output_held = true;
+            if (self->in_flight > 0) self->socket.cancel(error);
+            else self->quiet = true;
+        });
+    }
+
+    bool is_quiet()
+    {
+        return quiet;
+    }
+
+    // Take the connection out of the session for a copyover, with whatever is still owed to the client and whatever it typed
+    // that hasn't been handled
+    // (Only once the io_context has stopped, so nothing else is touching the session, and after hold_output())
+    // Returns false, closing the socket, if the connection can't be carried over
+    bool handoff(tbdmud::copyover_session& handed)
+    {
+        error_code error;
+        if (closing || !socket.is_open()) return false;
+
+        // The output wasn't held in time - part of the write may have gone, and there's no knowing how much
+        if (in_flight > 0) {
+            socket.close(error);
+            return false;
+        }
+
+        // The output as it goes on the wire - compressed if they have MCCP2 on, with the stream finished so the new server starts
+        // from plain text (it starts compression again)
+        std::string pending = std::move(unsent);
+        for (const outbound_message& message : outgoing) {
+            if (compression == COMPRESSED) deflate_onto(pending, *message.buffer, Z_NO_FLUSH);
+            else pending += *message.buffer;
+
+            if (message.starts_compression) start_compression();
+        }
+
+        handed.compressed = (compression != UNCOMPRESSED);
+        if (compression == COMPRESSED) finish_compression(pending);
+
+        handed.input = std::string(telnet.get_partial_line()) + std::string(read_buffer.data() + read_start, read_end - read_start);
+
+        handed.id            = session_id;
+        handed.ip            = ip_address;
+        handed.port          = port;
+        handed.width         = telnet.get_width();
+        handed.height        = telnet.get_height();
+        handed.terminal_type = telnet.get_terminal_type();
+        handed.pending       = std::move(pending);
+        handed.fd            = socket.release(error);
+        return !error;
+    }
+
+    // Pick up a connection handed over by a copyover, in place of start()
+    void resume(const tbdmud::copyover_session& handed, command_handler&& on_command, error_handler&& on_error)
+    {
+        this->on_command = std::move(on_command);
+        this->on_error = std::move(on_error);
+        ip_address = handed.ip;
+        port       = handed.port;
+        telnet.restore(handed.width, handed.height, handed.terminal_type);
+
+        io::dispatch(socket.get_executor(), [self = shared_from_this(), pending = handed.pending, typed = handed.input, compressed = handed.compressed, logged_in = handed.logged_in] {
+            if (!pending.empty()) self->queue_message(make_buffer(pending), true);
+
+            // What they'd typed is parsed as if it had just been read (a line longer than the read buffer loses its end)
+            self->received   = std::chrono::steady_clock::now();
+            self->read_start = 0;
+            self->read_end   = std::min(typed.size(), self->read_buffer.size());
+            std::memcpy(self->read_buffer.data(), typed.data(), self->read_end);
+
+            // Their stream was finished before the exec, but they still have MCCP2 on, so it starts again
+            if (compressed && (self->compression_level > 0)) {
+                self->telnet.set_local_enabled(tbdmud::telnet::OPT_COMPRESS2);
+                self->begin_compression();
+            }
+
+            if (logged_in) {
+                self->input_state = PLAYING;
+                self->process_input();
+            }
+            else {
+                self->async_login_username();
+            }
+        });
+    }
+
+    // The server accepted the username - start handling asynchronous command inputs
+    void login_accepted()
+    {
+        io::dispatch(socket.get_executor(), [self = shared_from_this()] {
+            self->input_state = PLAYING;
+            self->process_input();
+        });
+    }
+
+    // The username is already in use - ask for another one
+    void login_rejected(std::string playername)
+    {
+        post("\n" + playername + " is already in use\n");
+        io::dispatch(socket.get_executor(), [self = shared_from_this()] { self->async_login_username(); });  // Run this again instead of async_read()
     }
 
     // Message handler - put a message in the outgoing queue - if we're idle and not sending a message already, start the write process
+    // Shared messages (broadcasts, room chatter) are non-critical by default, so they can be dropped if this client falls behind
+    // (This can be called from any thread - the message is handed over to this session's strand)
+    void post(shared_buffer message, bool critical = false)
+    {
+        io::dispatch(socket.get_executor(), [self = shared_from_this(), message = std::move(message), critical] () mutable
+        {
+            self->queue_message(std::move(message), critical);
+        });
+    }
+
+    // Post a message only this session will receive (a prompt or a reply, so it's critical)
     void post(std::string const& message)
     {
-        bool idle = outgoing.empty();
-        outgoing.push(message);
+        post(make_buffer(message), true);
+    }
 
-        if(idle)
-        {
-            async_write();
-        }
+    void set_limits(const outbound_limits& l) {
+        limits = l;
+    }
+
+    // The zlib level (1-9) to compress with if the client agrees to MCCP2, 0 not to offer it (before start())
+    void set_compression_level(int level) {
+        compression_level = level;
+    }
+
+    uint64_t get_dropped_bytes() {
+        return dropped_bytes;
+    }
+
+    uint64_t get_dropped_messages() {
+        return dropped_messages;
+    }
+
+    uint64_t get_bytes_written() {
+        return bytes_written;
+    }
+
+    // The outbound queue, as of the last time it changed
+    int64_t get_queued_messages() {
+        return reported_messages;
+    }
+
+    int64_t get_queued_bytes() {
+        return reported_bytes;
     }
 
     void login() {
-        async_login_username();  // Get username or "new" from user
+        io::dispatch(socket.get_executor(), [self = shared_from_this()] { self->async_login_username(); });  // Get username or "new" from user
         //login_password();  // TODO
     }
 
+    uint get_id() {
+        return session_id;
+    }
+
+    std::string get_ip() {
+        return ip_address;
+    }
+
+    int get_port() {
+        return port;
+    }
+
+    // Set the player object once the server has created it (on the world's strand)
+    void set_player(std::shared_ptr<tbdmud::player> p) {
+        player = p;
+    }
+
     // Return a shared pointer to the player object
     std::shared_ptr<tbdmud::player> get_player() {
         return player;
     }
+
+private:
+    // Put a message in the outgoing queue (on this session's strand)
+    void queue_message(shared_buffer message, bool critical, bool starts_compression = false)
+    {
+        if (closing) return;
+
+        bool idle = outgoing.empty() && !write_scheduled;
+        queued_bytes += message->size();
+        outgoing.push_back(outbound_message{std::move(message), critical, 0, starts_compression});
+        if (!critical) queued_droppable++;
+
+        if (idle && !output_held)
+        {
+            // Start the write after whatever else is queued on this strand right now, so a burst of messages goes out as one write
+            write_scheduled = true;
+            io::post(socket.get_executor(), [self = shared_from_this()] {
+                self->write_scheduled = false;
+                if (!self->closing && !self->output_held && (self->in_flight == 0) && !self->outgoing.empty()) self->async_write();
+            });
+        }
+        else
+        {
+            enforce_limits();
+        }
+
+        stats().queue_depth.record((uint64_t) outgoing.size());
+        report_queue();
+    }
 };
 
 #endif
@@ -0,0 +1,83 @@
+// This file contains the symbol table that interns the names of characters, rooms and zones,
+// so the rest of the server can pass around and compare small integer IDs instead of strings
+
+#ifndef TBDMUD_SYMBOLS_H_INCLUDED
+#define TBDMUD_SYMBOLS_H_INCLUDED
+
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+namespace tbdmud {
+
+// A dense integer ID standing in for a name
+using symbol = uint32_t;
+
+// The ID of the empty name, used to mean "not set"
+const symbol NO_SYMBOL = 0;
+
+// Maps each distinct name to a dense ID once (at login or world load), and the IDs back to names for rendering text
+// IDs are never reused, so an ID stays valid (and keeps meaning the same name) for the life of the server
+// Every zone shard reads it from its own thread, so lookups take a shared lock and only interning a new name takes it exclusively
+class symbol_table {
+    private:
+        std::shared_mutex                                lock;
+        std::deque<std::string>                          names;   // Indexed by ID (a deque so the views in ids stay valid as it grows)
+        std::unordered_map<std::string_view, symbol>     ids;     // Keyed by views into names
+
+    public:
+        symbol_table() {
+            names.emplace_back("");
+            ids.insert({names.back(), NO_SYMBOL});
+        }
+
+        // Return the ID for a name, assigning the next one if we haven't seen it before
+        symbol intern(std::string_view name) {
+            std::unique_lock<std::shared_mutex> guard(lock);
+            std::unordered_map<std::string_view, symbol>::iterator i = ids.find(name);
+            if (i != ids.end()) return i->second;
+
+            symbol id = names.size();
+            names.emplace_back(name);
+            ids.insert({names.back(), id});
+            return id;
+        }
+
+        // Return the ID for a name without interning it - NO_SYMBOL if it has never been interned
+        symbol find(std::string_view name) {
+            std::shared_lock<std::shared_mutex> guard(lock);
+            std::unordered_map<std::string_view, symbol>::iterator i = ids.find(name);
+            return (i != ids.end()) ? i->second : NO_SYMBOL;
+        }
+
+        // Return the name for an ID (the reference stays valid, the deque never moves its elements)
+        const std::string& name(symbol id) {
+            std::shared_lock<std::shared_mutex> guard(lock);
+            return names[id];
+        }
+
+        // Make room for n names in total, before interning a lot of them at once
+        void reserve(size_t n) {
+            std::unique_lock<std::shared_mutex> guard(lock);
+            ids.reserve(n);
+        }
+
+        size_t size() {
+            std::shared_lock<std::shared_mutex> guard(lock);
+            return names.size();
+        }
+};
+
+// The one symbol table shared by the world, zones, rooms, characters and events
+inline symbol_table& symbols() {
+    static symbol_table table;
+    return table;
+}
+
+}  // end namespace tbdmud
+
+#endif
@@ -15,64 +15,124 @@ class server
 {
 private:
     io::io_context& io_context;                             // The main I/O service provider that handles executing asynchronous scheduled tasks
+    world_strand& strand;                                   // The strand the world runs on - everything below is only touched on it
     tcp::acceptor acceptor;                                 // An object that accepts incoming connections
     std::optional<tcp::socket> socket;                      // A socket object that can be "null"
     std::unordered_set<std::shared_ptr<session>> clients;   // A set of connected clients
     uint num_connections = 0;
+    uint session_counter = 0;                               // Used to give each session a unique ID
+    tbdmud::gauge&     connections       = tbdmud::metrics().get_gauge("tbdmud_connections", "Clients connected now");
+    tbdmud::counter&   connections_total = tbdmud::metrics().get_counter("tbdmud_connections_total", "Clients that have connected");
+    tbdmud::histogram& session_bytes     = tbdmud::metrics().get_histogram("tbdmud_session_bytes_written", "Bytes written to each client over its whole session, recorded when it disconnects");
+    outbound_limits limits;                                 // Outbound queue limits given to each new session
+    int compression_level = 6;                              // The zlib level sessions compress with if their client agrees to MCCP2 (0 = don't offer it)
+    bool copyover_pending = false;                          // Set once a copyover has started, so it only starts once
+    std::chrono::steady_clock::time_point copyover_started;
+    io::steady_timer drain_timer;                           // Checks whether the clients' output has been written, before a copyover
 
     tbdmud::world* world;                                   // Pointer to the world object in the server
-    std::function<std::shared_ptr<tbdmud::character>(session*, std::string)> create_character;    // Create a function pointer to the world's create_character() function
-    std::function<void(session*, std::shared_ptr<tbdmud::character>)>        register_character;  // Create a function pointer to the world's register_character() function
-    std::function<void(std::string)>                                         remove_character;    // Create a function pointer to the world's remove_character() function
-    std::function<bool(std::string)>                                         player_exists;       // Create a function pointer to the server's does_player_exist() function
 
 public:
 
-    // Class Constructor
-    server(io::io_context& io_context, std::uint16_t port) : io_context(io_context), acceptor(io_context, tcp::endpoint(tcp::v4(), port))
+    // Class Constructor that accepts a world object pointer and the strand the world runs on
+    // After a copyover the listening socket is handed over already open, instead of binding the port again
+    server(io::io_context& io_context, world_strand& strand, std::uint16_t port, tbdmud::world* world_ptr, int listener = -1)
+        : io_context(io_context), strand(strand), acceptor(io_context), drain_timer(strand)
     {
+        world = world_ptr;  // Store a point to the world object
+
+        if (listener >= 0) {
+            acceptor.assign(tcp::v4(), listener);
+        }
+        else {
+            tcp::endpoint endpoint(tcp::v4(), port);
+            acceptor.open(endpoint.protocol());
+            acceptor.set_option(tcp::acceptor::reuse_address(true));
+            acceptor.bind(endpoint);
+            acceptor.listen();
+        }
     }
 
-    // Class Constructor that accepts a world object pointer
-    server(io::io_context& io_context, std::uint16_t port, tbdmud::world* world_ptr) : io_context(io_context), acceptor(io_context, tcp::endpoint(tcp::v4(), port))
-    {
-        world = world_ptr;  // Store a point to the world object
+    // Set the outbound queue limits for sessions that connect from now on
+    void set_outbound_limits(const outbound_limits& l) {
+        limits = l;
+    }
 
-        // Create a function pointer to the world's character handling functions that can be used here or passed to session objects
-          create_character = std::bind(&tbdmud::world::create_character  , world, std::placeholders::_1, std::placeholders::_2);
-        register_character = std::bind(&tbdmud::world::register_character, world, std::placeholders::_1, std::placeholders::_2);
-          remove_character = std::bind(&tbdmud::world::remove_character,   world, std::placeholders::_1);
-          player_exists    = std::bind(&server::does_player_exist, this, std::placeholders::_1);
+    // Set the MCCP2 compression level (1-9, 0 to not offer it) for sessions that connect from now on
+    void set_compression_level(int level) {
+        compression_level = level;
     }
 
-    bool does_player_exist(std::string name) {
-        if (boost::iequals(name, "world")) return true;  // TODO:  Fix that if someone names themselves "world" the server crashes
+    // Check the username a session asked for, and if it's free load their account and create their player and character
+    // (Called from the session's strand, so hand it over to the world's strand)
+    void login(std::shared_ptr<session> client, std::string name)
+    {
+        io::post(strand, [this, client, name]
+        {
+            if (clients.count(client) == 0) return;  // They disconnected while we were waiting
 
-        // Test to see if that player name (or a case-insensitive version of it) already exists on the server
-        for (std::shared_ptr<session> client : clients) {
-            if (client->get_player() != nullptr) {
-                if (boost::iequals(name, client->get_player()->get_name())) return true;
+            // Hold the name while their account loads, so nobody else can log in as them in the meantime
+            if (!world->get_online().claim(name)) {
+                client->login_rejected(name);
+                return;
             }
-        }
 
-        return false;
+            // Reading the account happens on the player store's threads, then we come back to the world's strand to let them in
+            world->get_accounts().load(name, [this, client, name] (std::optional<tbdmud::player_account> account)
+            {
+                io::post(strand, [this, client, name, account = std::move(account)] () mutable
+                {
+                    // They disconnected while their account loaded
+                    if (clients.count(client) == 0) {
+                        world->get_online().release(name);
+                        return;
+                    }
+
+                    if (!account) {
+                        account.emplace();
+                        account->name    = name;
+                        account->created = std::time(nullptr);
+                        std::cout << "Session->Creating new account " << name << std::endl;
+                    }
+                    account->last_login = std::time(nullptr);
+                    account->logins++;
+
+                    // The account keeps the name the way it was first typed
+                    std::shared_ptr<tbdmud::player> player = std::shared_ptr<tbdmud::player>(new tbdmud::player(account->name, client->get_id(), true, client->get_ip(), client->get_port()));
+                    client->set_player(player);
+
+                    std::cout << "User " << player->get_name() << " has connected from " << player->get_ip() << ":" << player->get_port() << std::endl << std::endl;
+                    client->post("User " + player->get_name() + " has connected.\n");
+
+                    world->create_character(client, std::move(*account));
+
+                    client->login_accepted();
+                });
+            });
+        });
     }
 
     void async_accept()
     {
-        socket.emplace(io_context);
+        // Each session gets its own strand for its socket
+        socket.emplace(io::make_strand(io_context));
 
-        // Anytime a new client connects
-        acceptor.async_accept(*socket, [&] (error_code error)
+        // Anytime a new client connects (the handler runs on the world's strand)
+        acceptor.async_accept(*socket, io::bind_executor(strand, [&] (error_code error)
         {
             const std::string welcome_msg = "\n\rWelcome to TBDMud!\n\r\n\r";
             const std::string connect_notice = "has connected to TBDMud!\n\r";
 
             num_connections++;
+            session_counter++;
+            connections.add(1);
+            connections_total.add();
             std::cout << "Number of connections:  " << num_connections << std::endl;
 
             // Create the new client's session
-            std::shared_ptr<session> client = std::make_shared<session>(std::move(*socket), num_connections, create_character, player_exists);
+            std::shared_ptr<session> client = std::make_shared<session>(std::move(*socket), session_counter, std::bind(&server::login, this, std::placeholders::_1, std::placeholders::_2));
+            client->set_limits(limits);
+            client->set_compression_level(compression_level);
 
             // Write our welcome message to the new client
             client->post(welcome_msg);
@@ -84,38 +144,193 @@ public:
             clients.insert(client);
 
             // Start the asynchronous command handler for this client entering the game
-            client->start
-            (
-                // Pass in the command handler in the world object
-                //std::bind(&server::post, this, std::placeholders::_1),
-                std::bind(&tbdmud::world::command_parse, world, client, std::placeholders::_1),
-
-                // Pass in the error handler (runs on disconnect)
-                [&, client]
+            client->start(command_handler_for(client), error_handler_for(client));
+
+            // A copyover is under way, they'll be handed over with everyone else
+            if (copyover_pending) {
+                client->hold_input();
+                client->hold_output();
+            }
+
+            async_accept();
+        }));
+    }
+
+    // Start a copyover (on the world's strand) - stop reading the clients' input (what they type next is left for the new server),
+    // give their output a moment to drain, then stop writing it and call ready, which stops the io_context so main can hand
+    // everything over to the new binary
+    void begin_copyover(std::function<void()> ready)
+    {
+        if (copyover_pending) return;
+        copyover_pending = true;
+        copyover_started = std::chrono::steady_clock::now();
+
+        std::cout << "Copyover:  handing " << clients.size() << " connection(s) over to a new server" << std::endl;
+        post("\n*** The server is restarting, hold on... ***\n\r");
+        for (const std::shared_ptr<session>& client : clients) {
+            client->hold_input();
+        }
+
+        drain_timer.expires_after(std::chrono::milliseconds(10));
+        drain_timer.async_wait([this, ready] (error_code /*error*/) { check_drained(ready); });
+    }
+
+    // Take every connection out of its session for the copyover (once the io_context has stopped)
+    tbdmud::copyover_state handoff()
+    {
+        tbdmud::copyover_state state;
+        error_code error;
+
+        state.listener        = acceptor.release(error);
+        state.session_counter = session_counter;
+
+        for (const std::shared_ptr<session>& client : clients) {
+            tbdmud::copyover_session handed;
+            if (!client->handoff(handed)) {
+                std::cout << "Copyover:  session " << client->get_id() << " couldn't be handed over, it was dropped" << std::endl;
+                continue;
+            }
+
+            // Their account, with where they're standing now (they may still be logging in, if so they're asked for their name again)
+            const tbdmud::player_account* account = (client->get_player() != nullptr) ? world->get_current_account(client->get_player()->get_character()->get_id()) : nullptr;
+            if (account != nullptr) {
+                handed.logged_in = true;
+                handed.account   = *account;
+            }
+
+            state.sessions.push_back(std::move(handed));
+        }
+
+        return state;
+    }
+
+    // Pick up the connections handed over by a copyover and put everyone back in the world (before the io_context runs)
+    void restore(const tbdmud::copyover_state& state)
+    {
+        session_counter = state.session_counter;
+
+        for (const tbdmud::copyover_session& handed : state.sessions) {
+            error_code  error;
+            tcp::socket client_socket(io::make_strand(io_context));
+            client_socket.assign(tcp::v4(), handed.fd, error);
+            if (error) {
+                std::cout << "Copyover:  can't take over session " << handed.id << "'s socket:  " << error.message() << std::endl;
+                ::close(handed.fd);
+                continue;
+            }
+
+            num_connections++;
+            connections.add(1);
+
+            std::shared_ptr<session> client = std::make_shared<session>(std::move(client_socket), handed.id, std::bind(&server::login, this, std::placeholders::_1, std::placeholders::_2));
+            client->set_limits(limits);
+            client->set_compression_level(compression_level);
+            clients.insert(client);
+
+            if (handed.logged_in) {
+                std::shared_ptr<tbdmud::player> player = std::shared_ptr<tbdmud::player>(new tbdmud::player(handed.account.name, handed.id, true, handed.ip, handed.port));
+                client->set_player(player);
+                world->create_character(client, handed.account);
+            }
+
+            client->resume(handed, command_handler_for(client), error_handler_for(client));
+        }
+
+        std::cout << "Copyover:  " << clients.size() << " connection(s) taken over" << std::endl;
+        post("\n*** The server has restarted ***\n\r");
+    }
+
+private:
+    // The command handler for a client - it hands each line to the world (run on the world's strand)
+    command_handler command_handler_for(std::shared_ptr<session> client)
+    {
+        return [this, client] (std::string line, std::chrono::steady_clock::time_point received)
+        {
+            io::post(strand, [this, client, line = std::move(line), received] () mutable
+            {
+                world->command_parse(client, std::move(line), received);
+            });
+        };
+    }
+
+    // The error handler for a client (runs on disconnect)
+    error_handler error_handler_for(std::shared_ptr<session> client)
+    {
+        return [this, client]
+        {
+            io::post(strand, [this, client]
+            {
+                if(clients.erase(client))
                 {
-                    const std::string character_name = client->get_player()->get_character()->get_name();  // Copy the name before we delete the client
+                    num_connections--;
+                    connections.add(-1);
+                    session_bytes.record(client->get_bytes_written());
+                    std::cout << "Number of connections:  " << num_connections << std::endl;
 
-                    if(clients.erase(client))
-                    {
-                        post(character_name + " has disconnected.\n\r");
-                        remove_character(character_name);  // Remove the character from the world
+                    // They may have disconnected before logging in
+                    if (client->get_player() == nullptr) return;
 
-                        num_connections--;
-                        std::cout << "Number of connections:  " << num_connections << std::endl;
+                    const std::string character_name = client->get_player()->get_character()->get_name();  // Copy the name before we delete the client
+                    post(character_name + " has disconnected.\n\r");
+                    world->remove_character(character_name);  // Remove the character from the world
+
+                    if (client->get_dropped_messages() > 0) {
+                        std::cout << character_name << " dropped " << client->get_dropped_messages() << " messages (" << client->get_dropped_bytes() << " bytes) while not reading" << std::endl;
                     }
                 }
-            );
+            });
+        };
+    }
 
-            async_accept();
-        });
+    // Wait until every client's output has been written (or a stalled client has held things up long enough), then hold it
+    void check_drained(std::function<void()> ready)
+    {
+        const std::chrono::milliseconds max_wait(250);
+        bool drained = true;
+
+        for (const std::shared_ptr<session>& client : clients) {
+            if (client->get_queued_messages() > 0) {
+                drained = false;
+                break;
+            }
+        }
+
+        if (drained || (std::chrono::steady_clock::now() - copyover_started > max_wait)) {
+            for (const std::shared_ptr<session>& client : clients) {
+                client->hold_output();
+            }
+            check_quiet(ready);
+            return;
+        }
+
+        drain_timer.expires_after(std::chrono::milliseconds(10));
+        drain_timer.async_wait([this, ready] (error_code /*error*/) { check_drained(ready); });
+    }
+
+    // Wait until no client has a write in flight (the ones that were still going have been cancelled), then hand over
+    // (A client that disconnects meanwhile drops out of the list)
+    void check_quiet(std::function<void()> ready)
+    {
+        for (const std::shared_ptr<session>& client : clients) {
+            if (!client->is_quiet()) {
+                drain_timer.expires_after(std::chrono::milliseconds(1));
+                drain_timer.async_wait([this, ready] (error_code /*error*/) { check_quiet(ready); });
+                return;
+            }
+        }
+
+        ready();
     }
 
-    // Send a message to all connected clients
+public:
+    // Send a message to all connected clients (rendered once, shared by every client's queue)
     void post(std::string const& message)
     {
+        shared_buffer buffer = make_buffer(message);
+
         for(auto& client : clients)
         {
-            client->post(message);
+            client->post(buffer);
         }
     }
 
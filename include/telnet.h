@@ -0,0 +1,348 @@
+// This file contains the telnet protocol parser each session runs its input through
+// It's a streaming state machine - bytes go in as they arrive off the socket (split anywhere, even in the middle of a command),
+// option negotiation is answered as it's seen, and lines come out one at a time as views into a buffer that's reused for every line
+
+#ifndef TBDMUD_TELNET_H_INCLUDED
+#define TBDMUD_TELNET_H_INCLUDED
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+namespace tbdmud {
+
+namespace telnet {
+
+// Commands (RFC 854)
+const uint8_t SE   = 240;   // End of subnegotiation
+const uint8_t NOP  = 241;
+const uint8_t DM   = 242;   // Data mark
+const uint8_t BRK  = 243;
+const uint8_t IP   = 244;   // Interrupt process
+const uint8_t AO   = 245;   // Abort output
+const uint8_t AYT  = 246;   // Are you there
+const uint8_t EC   = 247;   // Erase character
+const uint8_t EL   = 248;   // Erase line
+const uint8_t GA   = 249;   // Go ahead
+const uint8_t SB   = 250;   // Start of subnegotiation
+const uint8_t WILL = 251;
+const uint8_t WONT = 252;
+const uint8_t DO   = 253;
+const uint8_t DONT = 254;
+const uint8_t IAC  = 255;   // Interpret as command
+
+// Options
+const uint8_t OPT_ECHO      = 1;
+const uint8_t OPT_SGA       = 3;    // Suppress go ahead
+const uint8_t OPT_TTYPE     = 24;   // Terminal type (RFC 1091)
+const uint8_t OPT_NAWS      = 31;   // Negotiate about window size (RFC 1073)
+const uint8_t OPT_COMPRESS2 = 86;   // MCCP2 - everything we send after IAC SB COMPRESS2 IAC SE is a zlib stream
+
+// Terminal type subnegotiation
+const uint8_t IS   = 0;
+const uint8_t SEND = 1;
+
+}  // end namespace telnet
+
+class telnet_parser {
+    public:
+        static const size_t MAX_LINE           = 4096;   // Anything typed past this is dropped, the line still ends where the client ends it
+        static const size_t MAX_SUBNEGOTIATION = 256;
+
+    private:
+        enum parse_state {
+            DATA,
+            CR_SEEN,          // A CR ended the line, skip the LF (or NUL) that goes with it
+            COMMAND,          // After an IAC
+            OPTION,           // After IAC WILL/WONT/DO/DONT, the option comes next
+            SB_OPTION,        // After IAC SB
+            SB_DATA,
+            SB_IAC            // An IAC inside a subnegotiation - either IAC SE or an escaped 255
+        };
+
+        // Where an option is, at one end of the connection (a simplified RFC 1143 - enough that we never answer an answer)
+        struct option_state {
+            bool supported = false;   // We'll agree to it being turned on
+            bool enabled   = false;
+            bool requested = false;   // We asked for it, so the other end's WILL/DO (or WONT/DONT) is the answer
+        };
+
+        parse_state                     state = DATA;
+        uint8_t                         verb = 0;          // The WILL/WONT/DO/DONT waiting for its option
+        uint8_t                         sb_option = 0;
+        std::string                     sb_data;
+        std::string                     line;              // The line being typed (reused, so it only allocates until it's as long as the longest line)
+        bool                            ready = false;     // line is complete and waiting to be taken
+        std::string                     replies;           // Negotiation to send back, outside the normal message flow
+        std::array<option_state, 256>   remote;            // Options at the client's end (it says WILL, we say DO)
+        std::array<option_state, 256>   local;             // Options at our end (it says DO, we say WILL)
+        uint16_t                        width = 0;         // From NAWS, 0 until the client tells us
+        uint16_t                        height = 0;
+        std::string                     terminal_type;     // From TTYPE, empty until the client tells us
+
+        void send(uint8_t command, uint8_t option) {
+            replies += (char) telnet::IAC;
+            replies += (char) command;
+            replies += (char) option;
+        }
+
+        void end_line() {
+            ready = true;
+        }
+
+        void data(uint8_t c) {
+            switch (c) {
+                case '\r':
+                    end_line();
+                    state = CR_SEEN;
+                    break;
+                case '\n':
+                    end_line();
+                    break;
+                case '\b':
+                case 127:
+                    if (!line.empty()) line.pop_back();
+                    break;
+                default:
+                    // Other control characters (NUL, bells, the escape that starts an arrow key) don't belong in a command
+                    if (((c >= 32) || (c == '\t')) && (line.size() < MAX_LINE)) line += (char) c;
+                    break;
+            }
+        }
+
+        // The client said what it will (or won't) do at its end
+        void remote_option(bool will, uint8_t option) {
+            option_state& o = remote[option];
+
+            if (will) {
+                if (o.enabled) return;
+                if (o.supported) {
+                    if (!o.requested) send(telnet::DO, option);
+                    o.enabled = true;
+                    if (option == telnet::OPT_TTYPE) {
+                        replies += std::string{(char) telnet::IAC, (char) telnet::SB, (char) telnet::OPT_TTYPE, (char) telnet::SEND, (char) telnet::IAC, (char) telnet::SE};
+                    }
+                }
+                else {
+                    send(telnet::DONT, option);
+                }
+                o.requested = false;
+            }
+            else {
+                if (o.enabled && !o.requested) send(telnet::DONT, option);
+                o.enabled   = false;
+                o.requested = false;
+            }
+        }
+
+        // The client asked us to do (or not do) something at our end
+        void local_option(bool doit, uint8_t option) {
+            option_state& o = local[option];
+
+            if (doit) {
+                if (o.enabled) return;
+                if (o.supported) {
+                    if (!o.requested) send(telnet::WILL, option);
+                    o.enabled = true;
+                }
+                else {
+                    send(telnet::WONT, option);
+                }
+                o.requested = false;
+            }
+            else {
+                if (o.enabled && !o.requested) send(telnet::WONT, option);
+                o.enabled   = false;
+                o.requested = false;
+            }
+        }
+
+        void subnegotiation() {
+            switch (sb_option) {
+                case telnet::OPT_NAWS:
+                    if (sb_data.size() == 4) {
+                        width  = ((uint8_t) sb_data[0] << 8) | (uint8_t) sb_data[1];
+                        height = ((uint8_t) sb_data[2] << 8) | (uint8_t) sb_data[3];
+                    }
+                    break;
+                case telnet::OPT_TTYPE:
+                    if (!sb_data.empty() && (sb_data[0] == telnet::IS)) terminal_type = sb_data.substr(1);
+                    break;
+            }
+            sb_data.clear();
+        }
+
+    public:
+        // Let the client turn an option on at its end (it sends WILL and we answer DO)
+        void support_remote(uint8_t option) {
+            remote[option].supported = true;
+        }
+
+        // Let the client have us turn an option on at our end (it sends DO and we answer WILL)
+        void support_local(uint8_t option) {
+            local[option].supported = true;
+        }
+
+        // Ask the client to turn on a supported option at its end
+        void request_remote(uint8_t option) {
+            option_state& o = remote[option];
+            if (o.enabled || o.requested) return;
+            o.supported = true;
+            o.requested = true;
+            send(telnet::DO, option);
+        }
+
+        // Offer to turn on a supported option at our end
+        void request_local(uint8_t option) {
+            option_state& o = local[option];
+            if (o.enabled || o.requested) return;
+            o.supported = true;
+            o.requested = true;
+            send(telnet::WILL, option);
+        }
+
+        // Carry over what a client told us before a copyover (it thinks we already know, so it won't tell us again)
+        void restore(uint16_t w, uint16_t h, std::string type) {
+            width         = w;
+            height        = h;
+            terminal_type = std::move(type);
+            remote[telnet::OPT_NAWS].enabled  = (width != 0);
+            remote[telnet::OPT_TTYPE].enabled = !terminal_type.empty();
+        }
+
+        // An option at our end that was agreed to before a copyover
+        void set_local_enabled(uint8_t option) {
+            local[option].supported = true;
+            local[option].enabled   = true;
+        }
+
+        // Run bytes through the parser, stopping at the end of a line
+        // Returns how many bytes were used - if a line is ready the rest are still to be parsed, after the line is taken
+        size_t parse(const char* bytes, size_t n) {
+            if (ready) {
+                line.clear();
+                ready = false;
+            }
+
+            size_t i = 0;
+            while ((i < n) && !ready) {
+                uint8_t c = bytes[i++];
+
+                switch (state) {
+                    case CR_SEEN:
+                        state = DATA;
+                        if ((c == '\n') || (c == '\0')) break;
+                        // Anything else starts the next line
+                        [[fallthrough]];
+                    case DATA:
+                        if (c == telnet::IAC) state = COMMAND;
+                        else data(c);
+                        break;
+                    case COMMAND:
+                        state = DATA;
+                        switch (c) {
+                            case telnet::IAC:
+                                // An escaped 255 - it's dropped, since the line may be sent on to other clients as it is and there it would start a command
+                                // (UTF-8 never uses it)
+                                break;
+                            case telnet::WILL:
+                            case telnet::WONT:
+                            case telnet::DO:
+                            case telnet::DONT:
+                                verb  = c;
+                                state = OPTION;
+                                break;
+                            case telnet::SB:
+                                state = SB_OPTION;
+                                break;
+                            case telnet::EC:
+                                if (!line.empty()) line.pop_back();
+                                break;
+                            case telnet::EL:
+                            case telnet::IP:
+                                line.clear();
+                                break;
+                            default:
+                                break;   // NOP, GA and the rest mean nothing to a line-based game
+                        }
+                        break;
+                    case OPTION:
+                        state = DATA;
+                        if ((verb == telnet::WILL) || (verb == telnet::WONT)) remote_option(verb == telnet::WILL, c);
+                        else local_option(verb == telnet::DO, c);
+                        break;
+                    case SB_OPTION:
+                        sb_option = c;
+                        sb_data.clear();
+                        state = SB_DATA;
+                        break;
+                    case SB_DATA:
+                        if (c == telnet::IAC) state = SB_IAC;
+                        else if (sb_data.size() < MAX_SUBNEGOTIATION) sb_data += (char) c;
+                        break;
+                    case SB_IAC:
+                        if (c == telnet::SE) {
+                            subnegotiation();
+                            state = DATA;
+                        }
+                        else {
+                            if ((c == telnet::IAC) && (sb_data.size() < MAX_SUBNEGOTIATION)) sb_data += (char) c;
+                            state = SB_DATA;
+                        }
+                        break;
+                }
+            }
+
+            return i;
+        }
+
+        bool line_ready() const {
+            return ready;
+        }
+
+        // The finished line, without its CR/LF (only good until the next parse)
+        std::string_view get_line() const {
+            return line;
+        }
+
+        // What's been typed of a line that hasn't been finished yet (for a copyover, so it isn't lost)
+        std::string_view get_partial_line() const {
+            return ready ? std::string_view() : std::string_view(line);
+        }
+
+        bool has_replies() const {
+            return !replies.empty();
+        }
+
+        // The negotiation to send the client, taking it out of the parser
+        std::string take_replies() {
+            std::string r = std::move(replies);
+            replies.clear();
+            return r;
+        }
+
+        bool is_remote_enabled(uint8_t option) const {
+            return remote[option].enabled;
+        }
+
+        bool is_local_enabled(uint8_t option) const {
+            return local[option].enabled;
+        }
+
+        uint16_t get_width() const {
+            return width;
+        }
+
+        uint16_t get_height() const {
+            return height;
+        }
+
+        const std::string& get_terminal_type() const {
+            return terminal_type;
+        }
+};
+
+}  // end namespace tbdmud
+
+#endif
@@ -0,0 +1,120 @@
+// This file contains the tokenizer that splits a line of player input into commands and words
+// Every piece it hands back is a string_view into the line itself, so parsing a line doesn't copy or allocate anything
+
+#ifndef TBDMUD_TOKENIZER_H_INCLUDED
+#define TBDMUD_TOKENIZER_H_INCLUDED
+
+#include <array>
+#include <cstddef>
+#include <string_view>
+
+namespace tbdmud {
+
+// The most words we split a single command into - anything past this is still available through rest()
+const size_t MAX_COMMAND_WORDS = 8;
+
+// One command from a line:  <command> <arg1> <arg2> ...
+// The views point into the line that was tokenized, so they're only valid while that line is
+class command {
+    private:
+        std::string_view                                  text;           // The whole command, with the surrounding spaces trimmed off
+        std::array<std::string_view, MAX_COMMAND_WORDS>   words;
+        size_t                                            num_words = 0;
+
+        static bool is_space(char c) {
+            return (c == ' ') || (c == '\t');
+        }
+
+    public:
+        command() {}
+
+        // Split the command into words separated by (runs of) spaces
+        command(std::string_view t) {
+            size_t start = 0;
+
+            // Trim the spaces around the command
+            while ((start < t.size()) && is_space(t[start])) start++;
+            size_t end = t.size();
+            while ((end > start) && is_space(t[end - 1])) end--;
+            text = t.substr(start, end - start);
+
+            size_t i = 0;
+            while ((i < text.size()) && (num_words < MAX_COMMAND_WORDS)) {
+                size_t word_start = i;
+                while ((i < text.size()) && !is_space(text[i])) i++;
+                words[num_words++] = text.substr(word_start, i - word_start);
+                while ((i < text.size()) && is_space(text[i])) i++;
+            }
+        }
+
+        // Number of words (at most MAX_COMMAND_WORDS)
+        size_t size() const {
+            return num_words;
+        }
+
+        bool empty() const {
+            return num_words == 0;
+        }
+
+        // The i'th word ("" if there aren't that many)
+        std::string_view word(size_t i) const {
+            return (i < num_words) ? words[i] : std::string_view();
+        }
+
+        std::string_view operator[] (size_t i) const {
+            return word(i);
+        }
+
+        // Everything after the first n words, as it was typed (the message for say, tell, etc)
+        std::string_view rest(size_t n = 1) const {
+            if (n == 0) return text;
+            if (n > num_words) return std::string_view();
+
+            size_t i = (words[n - 1].data() - text.data()) + words[n - 1].size();
+            while ((i < text.size()) && is_space(text[i])) i++;
+            return text.substr(i);
+        }
+
+        std::string_view str() const {
+            return text;
+        }
+};
+
+// Walks the commands in a line, which are separated by ;
+// Empty commands (;; or a trailing ;) are skipped, and the line ending is ignored
+class command_tokenizer {
+    private:
+        std::string_view remaining;
+
+    public:
+        command_tokenizer(std::string_view line) {
+            // Drop the CR/LF (or just the LF) the line came in with
+            while (!line.empty() && ((line.back() == '\n') || (line.back() == '\r'))) {
+                line.remove_suffix(1);
+            }
+            remaining = line;
+        }
+
+        // Put the next command into c, returns false once the line is used up
+        bool next(command& c) {
+            while (!remaining.empty()) {
+                size_t end = remaining.find(';');
+                std::string_view piece = remaining.substr(0, end);
+                remaining = (end == std::string_view::npos) ? std::string_view() : remaining.substr(end + 1);
+
+                c = command(piece);
+                if (!c.empty()) return true;
+            }
+
+            return false;
+        }
+
+        // The commands not handed out yet, still joined by ;
+        std::string_view rest() const {
+            return remaining;
+        }
+};
+
+}  // end namespace tbdmud
+
+#endif
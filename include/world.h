@@ -1,6 +1,10 @@
 #ifndef TBDMUD_WORLD_H_INCLUDED
 #define TBDMUD_WORLD_H_INCLUDED
 
+// All world mutation (and the server's own bookkeeping of its clients) is serialized on the world's strand, each zone runs on
+// its own shard's strand, and the sessions do their socket I/O on their own strands across however many threads run the io_context
+using world_strand = io::strand<io::io_context::executor_type>;
+
 namespace tbdmud {
 
 // The commands that are valid for a player to use
@@ -14,15 +18,634 @@ enum valid_commands {
     BROADCAST         // Broadcast a message to everyone in the world
 };
     
+// What gets passed between the world and the zone shards - an event, plus the session of the character it is about
+// when they are moving into the receiving shard (empty otherwise)
+struct mail {
+    tbdmud::event            event;
+    std::shared_ptr<session> client;
+};
+
+class world;
+
+// A shard is one zone together with everything needed to simulate it on its own - its event queue, its copy of the clock,
+// and the sessions of the characters in it - so every zone can run on a different thread at the same time
+// Nothing outside the zone is touched from here, anything that reaches further goes through the world's mailbox
+class shard {
+    private:
+        world*                                                 w;                      // To hand cross-zone events to the world
+        world_strand                                           strand;                 // Everything in this shard only runs on this strand
+        uint64_t                                               current_tick = 0;       // This shard's copy of the world clock, set by the world's tick
+        std::shared_ptr<event_queue>                           eq;
+        std::shared_ptr<zone>                                  z;
+        std::unordered_map<symbol, std::shared_ptr<session>>   clients;                // The sessions of the characters in this zone
+        mailbox<mail>                                          inbox;                  // Events handed to this zone by the world
+        bool                                                   queue_pending = false;  // Set while a queue drain is already scheduled
+
+        // This zone's metrics
+        histogram*                                             tick_time;              // How long on_tick() takes
+        gauge*                                                 queue_depth;            // Events waiting, due or not, after each drain
+        gauge*                                                 oldest_due;             // How long the first event of the last drain had been due
+        histogram*                                             event_wait;             // How long each event had been due when it was handled
+
+    public:
+        shard(std::string name, world* world_ptr, world_strand s) : w(world_ptr), strand(s) {
+            std::string zone_label = "zone=\"" + name + "\"";
+            tick_time   = &metrics().get_histogram("tbdmud_zone_tick_seconds", "Time to run a zone's tick", 1e-9, zone_label);
+            queue_depth = &metrics().get_gauge("tbdmud_event_queue_depth", "Events waiting in a queue, due or not", 1.0, zone_label);
+            oldest_due  = &metrics().get_gauge("tbdmud_event_oldest_due_seconds", "How long the oldest due event had waited at the last drain", 1e-9, zone_label);
+            event_wait  = &metrics().get_histogram("tbdmud_event_wait_seconds", "How long events wait between being due and being handled", 1e-9, zone_label);
+
+            // The zone's rooms and characters share this shard's event queue, which runs on this shard's clock
+            eq = std::shared_ptr<event_queue>(new event_queue(&current_tick));
+            eq->name = name;
+
+            // Immediate events wake the shard up instead of waiting for the next tick
+            // (Events are only added on this shard's strand, so the drain is posted to it as well)
+            eq->set_ready_handler([this] {
+                if (queue_pending) return;
+                queue_pending = true;
+                io::post(strand, [this] {
+                    queue_pending = false;  // Clear first so events added while we're draining schedule another pass
+                    process_events();
+                });
+            });
+
+            z = std::shared_ptr<zone>(new zone(name, eq));
+        };
+
+        // Exits are typed like commands, so their names go in the same registry (the world registers every exit name it loads)
+        static void register_exit(symbol exit_name) {
+            command_table().add(symbols().name(exit_name), {&shard::do_move, &move_latency()}, EXIT_PRIORITY);
+        };
+
+        symbol get_id() {
+            return z->get_id();
+        }
+
+        // The zone's rooms and exits don't change after it's created, so other shards may look at them but nothing else
+        std::shared_ptr<zone> get_zone() {
+            return z;
+        }
+
+        world_strand& get_strand() {
+            return strand;
+        }
+
+        event_pool& get_pool() {
+            return eq->get_pool();
+        }
+
+        // Run once a world tick on this shard's strand - catch the clock up, call whatever subscribed to ticks, then handle the events that came due
+        void on_tick(uint64_t tick) {
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            current_tick = tick;
+            z->run_ticks(tick);
+            process_events();
+            tick_time->record(std::chrono::steady_clock::now() - start);
+        };
+
+        // Hand an event to this shard from another thread
+        void deliver(mail&& m) {
+            if (inbox.deliver(std::move(m))) {
+                io::post(strand, [this] { collect_mail(); });
+            }
+        };
+
+        // Take the characters arriving in this zone in, and handle everything else that was delivered
+        // (These are handled right away rather than queued, so a line the world routes here after an arrival finds them in the zone)
+        void collect_mail() {
+            std::vector<mail> batch;
+            inbox.collect(batch);
+
+            for (mail& m : batch) {
+                if (m.client != nullptr) {
+                    clients[m.client->get_player()->get_character()->get_id()] = m.client;
+                }
+                process_event(m.event);
+            }
+        };
+
+        // Remove a character who disconnected from the room and zone they are in, and save their account (run on this shard's strand)
+        void remove_character(std::shared_ptr<session> client, player_account account) {
+            std::shared_ptr<character> c = client->get_player()->get_character();
+
+            // They may have moved on to another zone already (the world store still has where they were going)
+            if (clients.erase(c->get_id()) == 0) return;
+
+            std::shared_ptr<room> r = z->get_room(c->get_current_room());
+            r->leave_room(c);                                    // Remove the character from the room
+            z->leave_zone(c);                                    // Remove the character from the zone
+
+            account.zone = z->get_name();
+            account.room = r->get_name();
+            save_account(std::move(account));
+        };
+
+        // Find the session of a character in this zone (nullptr if they aren't here)
+        session* find_client(symbol c) {
+            std::unordered_map<symbol, std::shared_ptr<session>>::iterator i = clients.find(c);
+            return (i != clients.end()) ? i->second.get() : nullptr;
+        };
+
+        // Show a client the room they are in
+        void look(session* client, std::shared_ptr<room> current_room) {
+            client->post("\nYou are in:  " + current_room->get_name() + "\n");
+            client->post("exits:  " + current_room->get_exits_str() + "\n");
+            client->post("\nStanding around:\n" + current_room->get_character_str() + "\n");
+        };
+
+        // These need the world, so they're defined after it
+        symbol find_online(std::string_view name);
+        void send_to_world(mail&& m);
+        void reroute(std::shared_ptr<session> client, std::string line, std::chrono::steady_clock::time_point received);
+        void list_players(std::shared_ptr<session> client);
+        void save_location(std::shared_ptr<character> c, std::shared_ptr<room> r);
+        void save_account(player_account account);
+        void do_copyover(std::shared_ptr<session> client, const command& cmd, symbol name);
+
+        /***********************************************************************************************
+         * COMMAND PARSER
+         * Decode commands given by the client, create events and put them in the event queue
+         * Multiple commands can be given on a line, separated by ;
+         * Individual command arguments are separated by spaces: <command> <arg1> <arg2>, etc
+         * The first word is looked up in the command registry, which holds every exit name as well as the commands,
+         * and any unique prefix of a name works as an abbreviation (sh = shout)
+         ***********************************************************************************************/  
+        // Every command handler is called with the command, and the ID of the name it was registered under
+        using command_handler = void (shard::*)(std::shared_ptr<session>, const command&, symbol);
+
+        // What a name is registered with - its handler, and the histogram its latency goes in (looked up once, when it's registered)
+        struct command_binding {
+            command_handler handler;
+            histogram*      latency;
+        };
+
+        // The commands every zone understands - to add a command, write its handler below and register it here
+        // The shards add their zone's exit names to it as they're created, it isn't changed after that
+        static command_registry<command_binding>& command_table() {
+            static command_registry<command_binding> table = [] {
+                command_registry<command_binding> t;
+                auto add = [&t] (std::string_view name, command_handler handler) {
+                    t.add(name, {handler, &command_latency(name)});
+                };
+                add("help",      &shard::do_help);
+                add("?",         &shard::do_help);
+                add("who",       &shard::do_who);
+                add("look",      &shard::do_look);
+                add("l",         &shard::do_look);        // Keep l meaning look even if another command starting with l is added
+                add("tell",      &shard::do_tell);
+                add("say",       &shard::do_say);
+                add("dsay",      &shard::do_dsay);
+                add("shout",     &shard::do_shout);
+                add("broadcast", &shard::do_broadcast);
+                add("stats",     &shard::do_stats);       // Admins only
+                add("copyover",  &shard::do_copyover);    // Admins only
+                return t;
+            }();
+            return table;
+        }
+
+        // received is when the session read the line - the time from then until its events have been handled is recorded
+        // for the line's first command
+        void command_parse(std::shared_ptr<session> client, std::string line, std::chrono::steady_clock::time_point received)
+        {
+            std::shared_ptr<tbdmud::character> pc = client->get_player()->get_character();
+
+            // They moved out of this zone after the world routed the line here, let the world send it on to their new shard
+            if (clients.count(pc->get_id()) == 0) {
+                reroute(client, std::move(line), received);
+                return;
+            }
+    
+            // Every command and word below is a view into line, nothing is copied out of it
+            command_tokenizer commands(line);
+            command cmd;
+            histogram* latency = nullptr;   // The first command's
+
+            // Iterate over each command
+            while (commands.next(cmd)) {
+                #ifdef DEBUG
+                std::cout << "Processing command:  " << cmd[0] << std::endl;
+                #endif
+
+                command_registry<command_binding>::result r = command_table().find(cmd[0]);
+
+                if (latency == nullptr) {
+                    latency = (r.match == nullptr) ? &unknown_latency() : r.match->handler.latency;
+                }
+
+                if (r.match != nullptr) {
+                    (this->*(r.match->handler.handler))(client, cmd, r.match->id);
+                }
+                else if (r.ambiguous) {
+                    client->post("\nAmbiguous command or exit, type more of it\n");
+                }
+                else {
+                    #ifdef DEBUG
+                    std::cout << "\nUnknown command or exit\n" << std::endl;
+                    #endif
+                    client->post("\nUnknown command or exit\n");
+                }
+
+                // Handle what this command did before the next one, so "n;e" walks from the room "n" led to
+                process_events();
+
+                // That took them into another zone, so the rest of the line belongs to its shard
+                if (!commands.rest().empty() && (clients.count(pc->get_id()) == 0)) {
+                    reroute(client, std::string(commands.rest()), received);
+                    return;
+                }
+            }  // end while (commands)
+
+            if (latency != nullptr) latency->record(std::chrono::steady_clock::now() - received);
+        }; // end command_parse()
+
+        // The latency histogram for a command name (this takes the registry's lock, so it's only called as names are registered)
+        static histogram& command_latency(std::string_view command_name) {
+            return metrics().get_histogram("tbdmud_command_latency_seconds", "Time from reading a line to handling its events, by its first command", 1e-9,
+                                           "command=\"" + std::string(command_name) + "\"");
+        }
+
+        // Every exit shares one histogram, and so does every word that isn't a command or an exit
+        static histogram& move_latency() {
+            static histogram& h = command_latency("move");
+            return h;
+        }
+
+        static histogram& unknown_latency() {
+            static histogram& h = command_latency("unknown");
+            return h;
+        }
+
+        /***** ?/HELP *****/
+        void do_help(std::shared_ptr<session> client, const command& /*cmd*/, symbol /*name*/) {
+            client->post("\nHelp - Valid Commands:\n");
+            client->post("? or HELP       : help\n");
+            client->post("who             : show connected players\n");
+            client->post("look/l          : show room description\n");
+            client->post("tell player ... : only player hears ...\n");
+            client->post("say ...         : everyone in the room hears ...\n");
+            client->post("shout ...       : everyone in the zone hears ...\n");
+            client->post("broadcast ...   : everyone connected hears ...\n");
+            client->post("Commands and exits can be abbreviated, as long as it's clear which one you mean (sh = shout)\n\n");
+        };
+
+        /***** stats *****/
+        void do_stats(std::shared_ptr<session> client, const command& /*cmd*/, symbol /*name*/) {
+            if (!client->get_player()->is_admin()) {
+                client->post("\nUnknown command or exit\n");   // Players don't need to know it's there
+                return;
+            }
+
+            client->post("\nServer stats:\n" + metrics().summary() + "\nThis session:  " + std::to_string(client->get_bytes_written()) + " bytes written, " +
+                         std::to_string(client->get_queued_messages()) + " messages (" + std::to_string(client->get_queued_bytes()) + " bytes) queued\n\n");
+        };
+
+        /***** who *****/
+        void do_who(std::shared_ptr<session> client, const command& /*cmd*/, symbol /*name*/) {
+            list_players(client);  // Only the world knows who is connected in the other zones
+        };
+
+        /***** look/l *****/
+        void do_look(std::shared_ptr<session> client, const command& /*cmd*/, symbol /*name*/) {
+            std::shared_ptr<tbdmud::character> pc = client->get_player()->get_character();
+            #ifdef DEBUG
+            std::cout << "parsing look" << std::endl;
+            std::cout << "current_room = " << pc->get_current_room() << std::endl;
+            std::cout << "current_zone = " << pc->get_current_zone() << std::endl;
+            #endif
+            look(client.get(), z->get_room(pc->get_current_room()));
+        };
+
+        /***** tell <player> ... *****/
+        void do_tell(std::shared_ptr<session> client, const command& cmd, symbol /*name*/) {
+            if(cmd.size() < 3) {
+                client->post("Bad tell command format, expected:  tell player ...\n");
+                return;
+            }
+
+            tbdmud::speak_event tell_event;
+            tell_event.origin = client->get_player()->get_character()->get_id();
+            tell_event.scope  = tbdmud::event_scope::TARGET;
+
+            // Check if the target player is logged in, in any case (the world checks they're still connected when the tell gets there)
+            tell_event.target = find_online(cmd[1]);
+            if (tell_event.target == NO_SYMBOL) {
+                std::string error = "Player " + std::string(cmd[1]) + " is not connected.\n"; 
+                client->post(error);
+                return;
+            }
+
+            tell_event.message = eq->make_text(cmd.rest(2));   // Everything after the target name
+            std::cout << "tell event from " << symbols().name(tell_event.origin) << " to " << symbols().name(tell_event.target) << " : " << tell_event.message.str() << std::endl;
+            send_to_world(mail{std::move(tell_event), nullptr});
+        };
+
+        /***** say ... *****/
+        void do_say(std::shared_ptr<session> client, const command& cmd, symbol /*name*/) {
+            if(cmd.size() < 2) {
+                client->post("Bad say command format, expected:  say ...\n");
+                return;
+            }
+
+            tbdmud::speak_event say_event;
+
+            say_event.origin  = client->get_player()->get_character()->get_id();
+            say_event.scope   = tbdmud::event_scope::ROOM;
+            say_event.message = eq->make_text(cmd.rest());
+
+            std::cout << "say event:  SAY: " << say_event.message.str() << std::endl;
+            eq->add_event(std::move(say_event));
+        };
+
+        /***** dsay ... *****/
+        // TODO:  Remove temporary command "say with delay" for testing event delays
+        void do_dsay(std::shared_ptr<session> client, const command& cmd, symbol /*name*/) {
+            if(cmd.size() < 3) {
+                client->post("Bad dsay command format, expected:  say # ...\n");
+                return;
+            }
+
+            tbdmud::speak_event dsay_event;
+            uint delay = 0;
+            std::from_chars_result parsed = std::from_chars(cmd[1].data(), cmd[1].data() + cmd[1].size(), delay);
+            if (parsed.ec != std::errc()) {
+                client->post("Bad dsay command format, expected:  say # ...\n");
+                return;
+            }
+
+            dsay_event.origin  = client->get_player()->get_character()->get_id();
+            dsay_event.scope   = tbdmud::event_scope::ROOM;
+            dsay_event.message = eq->make_text(cmd.rest(2));   // Everything after the delay time
+
+            std::cout << "dsay event:  DSAY - " << delay << ":  " << dsay_event.message.str() << std::endl;
+            eq->add_event(std::move(dsay_event), delay);
+        };
+
+        /***** shout ... *****/
+        void do_shout(std::shared_ptr<session> client, const command& cmd, symbol /*name*/) {
+            if(cmd.size() < 2) {
+                client->post("Bad shout command format, expected:  shout # ...\n");
+                return;
+            }
+
+            tbdmud::speak_event shout_event;
+
+            shout_event.origin  = client->get_player()->get_character()->get_id();
+            shout_event.scope   = tbdmud::event_scope::ZONE;
+            shout_event.message = eq->make_text(cmd.rest());
+
+            std::cout << "shout event:  SHOUT:  " << shout_event.message.str() << std::endl;
+            eq->add_event(std::move(shout_event));
+        };
+
+        /***** broadcast ... *****/
+        void do_broadcast(std::shared_ptr<session> client, const command& cmd, symbol /*name*/) {
+            if(cmd.size() < 2) {
+                client->post("Bad broadcast command format, expected:  broadcast # ...\n");
+                return;
+            }
+            tbdmud::speak_event broadcast_event;
+
+            broadcast_event.origin  = client->get_player()->get_character()->get_id();
+            broadcast_event.scope   = tbdmud::event_scope::WORLD;
+            broadcast_event.message = eq->make_text(cmd.rest());
+
+            std::cout << "broadcast event:  BROADCAST:  " << broadcast_event.message.str() << std::endl;
+            send_to_world(mail{std::move(broadcast_event), nullptr});
+        };
+
+        /***** move *****/
+        // Registered under every exit name - the exit's ID is passed in as name, and looked up in the current room's exits
+        void do_move(std::shared_ptr<session> client, const command& cmd, symbol name) {
+            std::shared_ptr<tbdmud::character> pc = client->get_player()->get_character();
+
+            // Only a bare exit name is a move
+            if(cmd.size() != 1) {
+                client->post("\nUnknown command or exit\n");
+                return;
+            }
+
+            std::shared_ptr<room> origin_room = z->get_room(pc->get_current_room());
+            std::shared_ptr<room> target_room = origin_room->get_exit(name);
+            if (target_room == nullptr) {
+                client->post("\nYou can't go that way\n");
+                return;
+            }
+
+            tbdmud::move_event move_event;
+
+            move_event.origin      = pc->get_id();
+            move_event.origin_zone = z->get_id();
+            move_event.origin_room = origin_room->get_id();
+            move_event.target_zone = target_room->get_zone();   // Exits may lead into another zone
+            move_event.target_room = target_room->get_id();
+
+            #ifdef DEBUG
+            std::cout << "move event:  move " << symbols().name(move_event.origin) << " from " << symbols().name(move_event.origin_room) << " to " << symbols().name(move_event.target_room) << std::endl;
+            #endif
+            eq->add_event(std::move(move_event));
+        };
+
+        /***********************************************************************************************
+         * EVENT PROCESSOR
+         * Take an event and decode its kind, scope, and other parameters to determine the actions
+         * the zone should take in response (sending a message to a client's screen, moving a character
+         * from one room to another, etc)
+         ***********************************************************************************************/  
+        // Drain every event that is due at the current tick, returns the number of events processed
+        uint process_events() {
+            tbdmud::event event;
+            uint processed = 0;
+            std::chrono::steady_clock::duration waited;
+
+            // The queue will return false once there are no more events due at or before the current tick
+            while (eq->next_event(event, &waited)) {
+                if (processed == 0) oldest_due->set(std::chrono::duration_cast<std::chrono::nanoseconds>(waited).count());   // The first one out waited longest
+                event_wait->record(waited);
+                process_event(event);
+                processed++;
+            }
+
+            queue_depth->set(eq->size());
+            return processed;
+        };
+
+        // Dispatch the event to the handler for its kind
+        void process_event(tbdmud::event& event) {
+            std::visit([this] (auto& e) { handle_event(e); }, event);
+        };
+
+        void handle_event(notice_event& /*event*/) {
+            std::cout << "Error - NOTICE events are handled by the world, not zone " << z->get_name() << std::endl;
+        };
+
+        void handle_event(speak_event& event) {
+            symbol                     origin        = event.origin;
+            const std::string&         origin_name   = symbols().name(origin);     // Names are only looked up to render the text
+            const std::string&         message       = event.message.str();
+            session*                   origin_client = nullptr;
+            std::shared_ptr<character> origin_char   = nullptr;
+            std::shared_ptr<room>      origin_room   = nullptr; 
+            shared_buffer              heard;                                      // What everyone but the speaker sees, rendered once
+
+            origin_client = find_client(origin);
+            if (origin_client == nullptr) return;  // They disconnected (or left the zone) before the event came due
+            origin_char = origin_client->get_player()->get_character();
+
+            switch(event.scope) {
+                case ROOM:  // SAY Event
+                    std::cout << "SAY event:  " << message << std::endl;
+
+                    origin_room = z->get_room(origin_char->get_current_room());
+                    
+                    // Broadcast to everyone else in the room what the origin player said
+                    heard = make_buffer("\n" + origin_name + " says:  " + message + "\n\n");
+                    for (const std::shared_ptr<character>& ch : origin_room->get_characters()) {
+                        if (ch->get_id() != origin) {
+                            clients[ch->get_id()]->post(heard);
+                        }
+                        else {
+                            origin_client->post("\nYou say:  " + message + "\n\n");
+                        }
+                    }
+
+                    break;
+                case ZONE:  // Shout Event
+                    std::cout << "SHOUT event:  " << message << std::endl;
+
+                    // Broadcast to everyone else in the zone what the origin player said
+                    heard = make_buffer("\n" + origin_name + " shouts:  " + message + "\n\n");
+                    for (const std::shared_ptr<character>& ch : z->get_characters()) {
+                        if (ch->get_id() != origin) {
+                            clients[ch->get_id()]->post(heard);
+                        }
+                        else {
+                            origin_client->post("\nYou shout:  " + message + "\n\n");
+                        }
+                    }
+
+                    break;
+                case TARGET:  // TELL and BROADCAST reach outside the zone, so the world handles them
+                case WORLD:
+                    send_to_world(mail{std::move(event), nullptr});
+                    break;
+                default:
+                    std::cout << "Error - Unknown SPEAK event scope:  " << event.scope << std::endl;
+                    break;
+            }
+        };
+
+        // Moves within the zone are handled here from start to finish
+        // A move into another zone is handled in two halves - leaving the room here, then (after the world hands it over) arriving in the other shard
+        void handle_event(move_event& event) {
+            symbol                     origin           = event.origin;
+            const std::string&         origin_name      = symbols().name(origin);
+            const std::string&         origin_room_name = symbols().name(event.origin_room);
+            const std::string&         target_room_name = symbols().name(event.target_room);
+            session*                   origin_client    = nullptr;
+            std::shared_ptr<character> origin_char      = nullptr;
+            std::shared_ptr<room>      origin_room      = nullptr; 
+            std::shared_ptr<room>      target_room      = nullptr; 
+
+            if (origin != NO_SYMBOL) {
+                origin_client = find_client(origin);
+                if (origin_client == nullptr) return;  // They disconnected before the event came due
+                origin_char = origin_client->get_player()->get_character();
+            }
+
+            if (origin_char == nullptr || event.target_room == NO_SYMBOL) {
+                std::cout << "Error - Malformed MOVE event\n" << std::endl;
+                return;
+            }
+
+            // Leaving a room in this zone
+            if (event.origin_zone == z->get_id()) {
+                origin_room = z->get_room(event.origin_room);
+                std::cout << "MOVE event:  move " << origin_name << " from " << origin_room_name << " to " << target_room_name << std::endl;
+
+                // Broadcast to everyone else in the origin room that the player left
+                shared_buffer left = make_buffer("\n" + origin_name + " left the room towards " + target_room_name + "\n\n");
+                for (const std::shared_ptr<character>& ch : origin_room->get_characters()) {
+                    if (ch->get_id() != origin) {
+                        clients[ch->get_id()]->post(left);
+                    }
+                    else {
+                        origin_client->post("\nYou left the room\n\n");
+                    }
+                }
+
+                origin_room->leave_room(origin_char);
+
+                // Crossing into another zone - let go of the character and have the world hand them to that zone's shard
+                if (event.target_zone != z->get_id()) {
+                    z->leave_zone(origin_char);
+                    clients.erase(origin);
+                    send_to_world(mail{event, nullptr});
+                    return;
+                }
+            }
+            // Arriving from another zone (or logging in) - the session was taken in with the mail
+            else {
+                std::cout << "MOVE event:  " << origin_name << " arrives in zone " << z->get_name() << std::endl;
+                z->enter_zone(origin_char);
+            }
+
+            // Actually perform the room transition
+            target_room = z->get_room(event.target_room);
+            target_room->enter_room(origin_char);
+            save_location(origin_char, target_room);
+
+            // Broadcast to everyone else in the target room that the player has arrived
+            shared_buffer entered = make_buffer("\n" + origin_name + " has entered the room\n\n");
+            for (const std::shared_ptr<character>& ch : target_room->get_characters()) {
+                if (ch->get_id() != origin) {
+                    clients[ch->get_id()]->post(entered);
+                }
+                else {
+                    origin_client->post("\nYou have entered " + target_room_name + "\n\n");
+                }
+            }
+
+            // Show them around when they first log in
+            if (event.origin_zone == NO_SYMBOL) {
+                look(origin_client, target_room);
+            }
+        };
+};
+
+// Where a connected character is, so the world can reach them and route their commands to the zone they're in
+struct online_character {
+    std::shared_ptr<session> client;
+    shard*                   home;     // The shard of the zone they're in
+    player_account           account;  // Saved when they leave
+};
+
 // There is only one world object per server
 // The world is the root/container for all the zones, and handles global events
+// Each zone is simulated by its own shard, the world keeps the clock, the directory of who is connected where,
+// and handles everything that crosses zones (broadcasts, tells, and handing characters from one shard to another)
 class world {
     private:
-        std::map<std::string, session*>               char_to_client_map;  // To refer messages to characters back to the associated session
-        uint64_t                                      current_tick = 0;    // Master clock for the world (in ticks)    
-        std::map<std::string, std::shared_ptr<zone>>  zones;
-        std::shared_ptr<zone>                         start_zone;          // The default zone that new players should start in
-        std::shared_ptr<event_queue>                  eq;
+        world_strand&                                      strand;              // Everything in the world object only runs on this strand
+        std::unordered_map<symbol, online_character>       directory;           // To refer messages to characters back to the associated session
+        uint64_t                                           current_tick = 0;    // Master clock for the world (in ticks)    
+        std::unordered_map<symbol, std::shared_ptr<shard>> shards;              // One per zone, created with the world and never changed after
+        shard*                                             start_shard;         // The default zone that new players should start in
+        std::shared_ptr<event_queue>                       eq;                  // For world-wide events (the zones have their own)
+        mailbox<mail>                                      inbox;               // Events handed to the world by the shards
+        world_store                                        store;               // Saves the world to disk on its own thread
+        player_store                                       accounts;            // Every player's account, read and written on its own threads
+        online_index                                       online;              // Who is logged in (or logging in), by case-folded name
+        std::unordered_set<std::string>                    admins;              // Case-folded names of the players who can use the admin commands
+        std::function<void()>                              copyover_handler;    // The server's copyover (set by main)
+
+        // The world's metrics (the zones have their own)
+        histogram*                                         tick_time;           // How long tick() takes on the world's strand
+        counter*                                           ticks;
+        gauge*                                             queue_depth;         // The world's own event queue
+        gauge*                                             oldest_due;
+        histogram*                                         event_wait;
 
         // World States
         bool state_sun = false;   // Is the sun up?
@@ -31,87 +654,317 @@ class world {
     public:
         // World Constructor
         // In the beginning....
-        world() {
+        world(world_strand& s) : strand(s) {
             std::cout << "World Created" << std::endl;
             // Create the event queue with a pointer to the world tick counter
             eq = std::shared_ptr<event_queue>(new event_queue(&current_tick));
             eq->name = "TBDWorld";
 
-            // TODO:  Hard-coded test data until we can read it in from a file
-            zones.insert({"Zion", std::shared_ptr<zone>(new zone("Zion", eq))});
-            start_zone = zones["Zion"];
+            online.reserve("world");
+
+            tick_time   = &metrics().get_histogram("tbdmud_world_tick_seconds", "Time to run the world's tick", 1e-9);
+            ticks       = &metrics().get_counter("tbdmud_ticks_total", "World ticks run");
+            queue_depth = &metrics().get_gauge("tbdmud_event_queue_depth", "Events waiting in a queue, due or not", 1.0, "zone=\"world\"");
+            oldest_due  = &metrics().get_gauge("tbdmud_event_oldest_due_seconds", "How long the oldest due event had waited at the last drain", 1e-9, "zone=\"world\"");
+            event_wait  = &metrics().get_histogram("tbdmud_event_wait_seconds", "How long events wait between being due and being handled", 1e-9, "zone=\"world\"");
         };
 
         // World Destructor (Here there be Vogons)
         ~world() {}
 
+        // Create a zone, with its own shard running on its own strand
+        shard* add_zone(std::string name) {
+            std::shared_ptr<shard> s = std::shared_ptr<shard>(new shard(name, this, world_strand(strand.get_inner_executor())));
+            shards.insert({s->get_id(), s});
+            online.reserve(name);   // A character with a zone's name would share its symbol
+            return s.get();
+        };
+
+        // Build every zone and room from a compiled area image (see tools/areac.cpp), before the server starts
+        // The image is only mapped while the rooms are built - its tables are walked by index, there's nothing to parse
+        bool load_areas(const std::string& path) {
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            area_image image;
+
+            if (!image.open(path)) {
+                std::cout << "Error - Can't load the areas:  " << image.get_error() << std::endl;
+                return false;
+            }
+
+            symbols().reserve(symbols().size() + image.num_rooms() + image.num_zones());
+
+            std::vector<shard*>                  zone_shards(image.num_zones());
+            std::vector<std::shared_ptr<room>>   rooms(image.num_rooms());
+            std::unordered_map<uint32_t, symbol> exit_names;    // Exit names repeat a lot, intern each distinct one (by pool offset) once
+
+            for (uint32_t z = 0; z < image.num_zones(); z++) {
+                std::string_view name = image.str(image.zone(z).name);
+                if (name.empty() || (find_shard(symbols().find(name)) != nullptr)) {
+                    std::cout << "Error - Bad or duplicate zone name in " << path << std::endl;
+                    return false;
+                }
+                zone_shards[z] = add_zone(std::string(name));
+                zone_shards[z]->get_zone()->reserve_rooms(image.zone(z).num_rooms);
+            }
+
+            for (uint32_t r = 0; r < image.num_rooms(); r++) {
+                const area_room& ar = image.room(r);
+                if (ar.zone >= image.num_zones()) {
+                    std::cout << "Error - Room " << r << " is in a zone that doesn't exist in " << path << std::endl;
+                    return false;
+                }
+                rooms[r] = zone_shards[ar.zone]->get_zone()->create_room(image.str(ar.name));
+            }
+
+            // Now that every room exists, link up the exits (they may lead into another zone)
+            for (uint32_t r = 0; r < image.num_rooms(); r++) {
+                const area_room& ar = image.room(r);
+                if ((uint64_t) ar.first_exit + ar.num_exits > image.num_exits()) {
+                    std::cout << "Error - Room " << r << " has exits past the end of the exit table in " << path << std::endl;
+                    return false;
+                }
+
+                rooms[r]->reserve_exits(ar.num_exits);
+                for (uint32_t e = ar.first_exit; e < ar.first_exit + ar.num_exits; e++) {
+                    const area_exit& ae = image.exit(e);
+                    if (ae.target_room >= image.num_rooms()) {
+                        std::cout << "Error - Exit " << e << " leads to a room that doesn't exist in " << path << std::endl;
+                        return false;
+                    }
+
+                    std::unordered_map<uint32_t, symbol>::iterator n = exit_names.find(ae.name.offset);
+                    if (n == exit_names.end()) {
+                        n = exit_names.insert({ae.name.offset, symbols().intern(image.str(ae.name))}).first;
+                    }
+                    rooms[r]->add_exit(n->second, rooms[ae.target_room]);
+                }
+            }
+
+            for (uint32_t z = 0; z < image.num_zones(); z++) {
+                uint32_t start_room = image.zone(z).start_room;
+                if ((start_room >= image.num_rooms()) || (image.room(start_room).zone != z)) {
+                    std::cout << "Error - Zone " << z << " starts in a room outside it in " << path << std::endl;
+                    return false;
+                }
+                zone_shards[z]->get_zone()->set_start_room(rooms[start_room]);
+            }
+
+            for (std::pair<const uint32_t, symbol>& n : exit_names) {
+                shard::register_exit(n.second);
+            }
+
+            start_shard = zone_shards[0];  // The first zone in the image is where new characters start
+
+            double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            std::cout << "Loaded " << image.num_zones() << " zones, " << image.num_rooms() << " rooms and " << image.num_exits()
+                      << " exits from " << path << " in " << ms << " ms" << std::endl;
+            return true;
+        };
+
+        world_strand& get_strand() {
+            return strand;
+        }
+
+        world_store& get_store() {
+            return store;
+        }
+
+        player_store& get_accounts() {
+            return accounts;
+        }
+
+        online_index& get_online() {
+            return online;
+        }
+
+        // Recover the saved world from the data directory, and start saving changes to it
+        // (Call after load_areas, before the server starts)
+        bool open_store(const std::string& dir) {
+            if (!store.open(dir) || !accounts.open(dir)) return false;
+
+            // The players named in <dir>/admins (one to a line) can use the admin commands
+            std::ifstream admin_file(dir + "/admins");
+            std::string   admin;
+            while (admin_file >> admin) {
+                admins.insert(fold_name(admin));
+            }
+            if (!admins.empty()) std::cout << admins.size() << " admin(s)" << std::endl;
+
+            store.get_world_state(current_tick, state_sun, state_moon);
+            return true;
+        };
+
+        // Register the function that restarts the server binary for a copyover
+        void set_copyover_handler(std::function<void()> h) {
+            copyover_handler = h;
+        };
+
+        // Start a copyover (run on the world's strand)
+        void request_copyover() {
+            if (copyover_handler) copyover_handler();
+        };
+
+        // A connected character's account, with where they're standing now (nullptr if they aren't connected)
+        // For a copyover, once nothing else is running - the zones move characters on their own strands
+        const player_account* get_current_account(symbol c) {
+            std::unordered_map<symbol, online_character>::iterator i = directory.find(c);
+            if (i == directory.end()) return nullptr;
+
+            std::shared_ptr<character> pc = i->second.client->get_player()->get_character();
+            shard* s = find_shard(pc->get_current_zone());
+            std::shared_ptr<room> r = (s != nullptr) ? s->get_zone()->get_room(pc->get_current_room()) : nullptr;
+            if (r != nullptr) {
+                i->second.account.zone = s->get_zone()->get_name();
+                i->second.account.room = r->get_name();
+            }
+            return &i->second.account;
+        };
+
+        // Finish writing everything to disk
+        void save_to_disk() {
+            accounts.close();   // First, saving an account queues a record for the world store
+            store.close();
+        };
+
         // This function should be triggered asynchronously by the server, approximately every second
         // (We're not synchronizing to real world time)
         void tick() {
-            if (current_tick % 100 == 0) std::cout << "tick " << current_tick << std::endl;
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+            if (current_tick % 100 == 0) {
+                std::cout << "tick " << current_tick << std::endl;
+                print_pool_stats(eq->name, eq->get_pool());
+                for (std::pair<const symbol, std::shared_ptr<shard>>& s : shards) {
+                    print_pool_stats(symbols().name(s.first), s.second->get_pool());
+                }
+            }
             current_tick++;
 
-            // Call on_tick() for all the zones in this world, who will call it on all the rooms, who will call it on all the characters/objects
-            std::map<std::string, std::shared_ptr<zone>>::iterator z = zones.begin();
-            while (z != zones.end()) {
-                z->second->on_tick();
-                z++;
+            // Tick every zone on its own shard, which calls the rooms, characters and objects in it that subscribed to ticks
+            // The zones don't wait for each other, so they tick in parallel across the I/O threads
+            for (std::pair<const symbol, std::shared_ptr<shard>>& s : shards) {
+                shard* z = s.second.get();
+                uint64_t t = current_tick;
+                io::post(z->get_strand(), [z, t] { z->on_tick(t); });
             }
 
             periodic_events(current_tick);   // After processing the tick see if there are periodic world events to handle/create
+
+            ticks->add();
+            tick_time->record(std::chrono::steady_clock::now() - start);
         };
 
-        std::shared_ptr<zone> find_zone(std::string z) {
-            return zones[z];
+        void print_pool_stats(const std::string& name, event_pool& pool) {
+            std::cout << name << " event pool:  " << pool.get_acquired() << " messages, " << pool.get_buffer_allocs() << " buffer allocs" << std::endl;
         };
 
-        std::shared_ptr<room> find_room(std::string z, std::string r) {
-            return zones[z]->get_room(r);
+        // Find the shard for a zone (nullptr if there isn't one)
+        // The shards don't change after the world is created, so this is safe from any shard's strand
+        shard* find_shard(symbol z) {
+            std::unordered_map<symbol, std::shared_ptr<shard>>::iterator i = shards.find(z);
+            return (i != shards.end()) ? i->second.get() : nullptr;
         };
 
-        // Create a new character and put them in the starting room
-        std::shared_ptr<character> create_character(session* client, std::string name) {
-            std::cout << "world:  creating new character " << std::endl;
-            std::shared_ptr<character> c = std::shared_ptr<character>(new character(name));
+        // Find the session of a connected character (nullptr if they aren't connected)
+        session* find_client(symbol c) {
+            std::unordered_map<symbol, online_character>::iterator i = directory.find(c);
+            return (i != directory.end()) ? i->second.client.get() : nullptr;
+        };
 
-            // Broadcast to everyone else that a new player entered the room
-            for (std::shared_ptr<character> ch : start_zone->get_start_room()->get_characters()) {
-                char_to_client_map[ch->get_name()]->post("\n" + name + " has entered the room.\n");
+        // Create the character for the client's player and put them back where their account says they were
+        // (Or in the starting room, for a new account or if that room is gone)
+        std::shared_ptr<character> create_character(std::shared_ptr<session> client, player_account account) {
+            std::cout << "world:  creating character " << account.name << std::endl;
+            std::shared_ptr<character> c = std::shared_ptr<character>(new character(account.name));
+            client->get_player()->set_character(c);   // Before the shard sees them, it finds the character through the session
+            client->get_player()->set_admin(admins.count(fold_name(account.name)) > 0);
+
+            // The world store is newer than the account if the server stopped without saving it (it's logged on every move)
+            saved_location saved = {account.zone, account.room};
+            store.find_character(account.name, saved);
+
+            shard*                home       = start_shard;
+            std::shared_ptr<room> start_room = start_shard->get_zone()->get_start_room();
+            if (!saved.zone.empty()) {
+                shard* s = find_shard(symbols().find(saved.zone));
+                std::shared_ptr<room> r = (s != nullptr) ? s->get_zone()->get_room(saved.room) : nullptr;
+                if (r != nullptr) {
+                    home       = s;
+                    start_room = r;
+                }
             }
 
-            char_to_client_map.insert({name, client});
-            start_zone->enter_zone(c);
-            start_zone->get_start_room()->enter_room(c);
+            // Save the login, so the account exists on disk from their first one
+            account.zone = home->get_zone()->get_name();
+            account.room = start_room->get_name();
+            accounts.save(account);
 
-            client->post("\nYou have entered the room.\n");
+            directory.insert({c->get_id(), {client, home, std::move(account)}});
+            online.add(c->get_name(), c->get_id());
 
-            client->post("\nYou are in:  " + start_zone->get_start_room()->get_name() + "\n");
-            client->post("exits:  " + start_zone->get_start_room()->get_exits_str() + "\n");
-            client->post("\nStanding around:\n" + start_zone->get_start_room()->get_character_str() + "\n");
+            // Hand them to the zone's shard, which puts them in the room and tells everyone there
+            tbdmud::move_event arrive;
+            arrive.origin      = c->get_id();
+            arrive.target_zone = home->get_id();
+            arrive.target_room = start_room->get_id();
+            home->deliver(mail{std::move(arrive), client});
 
             return c;
         };
 
-        // Register an existing character and put them in the starting room
-        // TODO:  Put them in the room they logged out in
-        void register_character(session* client, std::shared_ptr<character> c) {
-            std::cout << "world:  registering character " << c->get_name() << std::endl;
-
-            char_to_client_map.insert({c->get_name(), client});
-            start_zone->enter_zone(c);
-            start_zone->get_start_room()->enter_room(c);
-        };
-
         // Delete a character - remove them from the room they are in and other cleanup
         void remove_character(std::string character_name) {
             std::cout << "world:  removing character " << character_name << std::endl;
 
-            std::shared_ptr<character> c = char_to_client_map[character_name]->get_player()->get_character();
-            std::string zone = c->get_current_zone();
-            std::string room = c->get_current_room();
-            find_room(zone, room)->leave_room(c);      // Remove the character from the room
-            find_zone(zone)->leave_zone(c);            // Remove the character from the zone
-            char_to_client_map.erase(character_name);  // Remove the character from the world
+            symbol id = online.find(character_name);
+            std::unordered_map<symbol, online_character>::iterator i = directory.find(id);
+            if (i == directory.end()) return;
+            online.release(character_name);
+
+            // The zone they are in removes them from its room and zone
+            shard* home = i->second.home;
+            std::shared_ptr<session> client = i->second.client;
+            io::post(home->get_strand(), [home, client, account = std::move(i->second.account)] () mutable { home->remove_character(client, std::move(account)); });
+
+            directory.erase(i);   // Remove the character from the world
+        };
+
+        // Hand an event to the world from a shard
+        void deliver(mail&& m) {
+            if (inbox.deliver(std::move(m))) {
+                io::post(strand, [this] { collect_mail(); });
+            }
+        };
+
+        // Handle everything the shards have delivered (run on the world's strand)
+        void collect_mail() {
+            std::vector<mail> batch;
+            inbox.collect(batch);
+
+            for (mail& m : batch) {
+                process_event(m.event);
+            }
+        };
+
+        // Route a line from a client to the shard of the zone they're in
+        void command_parse(std::shared_ptr<session> client, std::string line, std::chrono::steady_clock::time_point received = std::chrono::steady_clock::now()) {
+            std::unordered_map<symbol, online_character>::iterator i = directory.find(client->get_player()->get_character()->get_id());
+            if (i == directory.end()) return;  // They disconnected
+
+            shard* home = i->second.home;
+            io::post(home->get_strand(), [home, client, line = std::move(line), received] () mutable { home->command_parse(client, std::move(line), received); });
+        };
+
+        // List everyone connected, whatever zone they're in
+        void list_players(std::shared_ptr<session> client) {
+            client->post("\nConnected:\n");
+
+            std::unordered_map<symbol, online_character>::iterator c = directory.begin();
+            while (c != directory.end()) {
+                client->post(symbols().name(c->first) + "\n");
+                c++;
+            }
+            client->post("\n");
         };
 
         /***********************************************************************************************
@@ -122,495 +975,211 @@ class world {
 
             // Periodically make the sun rise or set
             if (current_tick % 42 == 0) {
-                std::shared_ptr<tbdmud::event_item> sun_event = std::shared_ptr<tbdmud::event_item>(new tbdmud::event_item());
-                sun_event->set_origin("world");  // TODO:  pick something that doesn't mess up if a character names themselves that
-                sun_event->set_name("SUN");
-                sun_event->set_type(tbdmud::event_type::NOTICE);
-                sun_event->set_scope(tbdmud::event_scope::WORLD);
+                tbdmud::notice_event sun_event;
                 if (!state_sun) {
-                    sun_event->set_message(tbdmud::event_scope::WORLD, "The sun rises");
+                    sun_event.message = eq->make_text("The sun rises");
                     state_sun = true;
                 }
                 else {
-                    sun_event->set_message(tbdmud::event_scope::WORLD, "The sun sets");
+                    sun_event.message = eq->make_text("The sun sets");
                     state_sun = false;
                 }
-                eq->add_event(sun_event);
+                eq->add_event(std::move(sun_event));
+                store.world_state(current_tick, state_sun, state_moon);
             }  
 
             // Periodically make the moon rise or set
             if (current_tick % 67 == 0) {
-                std::shared_ptr<tbdmud::event_item> moon_event = std::shared_ptr<tbdmud::event_item>(new tbdmud::event_item());
-                moon_event->set_origin("world");  // TODO:  pick something that doesn't mess up if a character names themselves that
-                moon_event->set_name("SUN");
-                moon_event->set_type(tbdmud::event_type::NOTICE);
-                moon_event->set_scope(tbdmud::event_scope::WORLD);
+                tbdmud::notice_event moon_event;
                 if (!state_moon) {
                     if (state_sun) {
-                        moon_event->set_message(tbdmud::event_scope::WORLD, "You can faintly see the moon rising");
+                        moon_event.message = eq->make_text("You can faintly see the moon rising");
                     }
                     else {
-                        moon_event->set_message(tbdmud::event_scope::WORLD, "The moon rises");
+                        moon_event.message = eq->make_text("The moon rises");
                     }
                     state_moon = true;
                 }
                 else {
                     if (state_sun) {
-                        moon_event->set_message(tbdmud::event_scope::WORLD, "You can faintly see the moon setting");
+                        moon_event.message = eq->make_text("You can faintly see the moon setting");
                     }
                     else {
-                        moon_event->set_message(tbdmud::event_scope::WORLD, "The moon sets");
+                        moon_event.message = eq->make_text("The moon sets");
                     }
                     state_moon = false;
                 }
-                eq->add_event(moon_event);
+                eq->add_event(std::move(moon_event));
+                store.world_state(current_tick, state_sun, state_moon);
             }  
         }
 
         /***********************************************************************************************
-         * COMMAND PARSER
-         * Decode commands given by the client, create events and put them in the priority queue
-         * Multiple commands can be given on a line, separated by ;
-         * Individual command arguments are separated by spaces: <command> <arg1> <arg2>, etc
-         * After all explicit commands are checked for, we will check to see if the command matches valid exits from the room
+         * EVENT PROCESSOR
+         * Handle the world-wide events, and the events the shards hand over because they reach outside their zone
          ***********************************************************************************************/  
-        void command_parse(std::shared_ptr<session> client, std::string line)
-        {
-            const std::string command_delimiters = ";";
-            const std::string parameter_delimiters = " ";
-            std::vector<std::string> commands;
-            std::shared_ptr<tbdmud::character>   pc = client->get_player()->get_character();
-            std::shared_ptr<tbdmud::event_queue> eq = pc->get_event_queue();
-    
-            line.pop_back();  // Remove the LF that comes with the line
-            line.pop_back();  // Remove the CR that comes with the line
-            boost::split(commands, line, boost::is_any_of(command_delimiters), boost::token_compress_on);  // Split the commands
-    
-            // Iterate over each command
-            for(std::string c : commands) {
-                #ifdef DEBUG
-                std::cout << "Parsing command line:  " << c << std::endl;
-                #endif
-
-                std::vector<std::string> v_command;
-                std::size_t c_position;
-                std::string message;
-
-                message = c;  // It's a little wasteful of memory, but we're going to keep a copy of the message instead of reconstructing it from the vector
+        // Register the function the event queue calls when an immediate event needs processing
+        void set_event_ready_handler(std::function<void()> h) {
+            eq->set_ready_handler(h);
+        };
 
-                // Chop the first word off the remaining message, keep the rest as the message to send
-                size_t space = message.find(" ");    
-                if (space != std::string::npos) {
-                  message = message.substr(space + 1);
-                }
+        // Drain every event that is due at the current tick, returns the number of events processed
+        uint process_events() {
+            tbdmud::event event;
+            uint processed = 0;
+            std::chrono::steady_clock::duration waited;
+
+            // The queue will return false once there are no more events due at or before the current tick
+            while (eq->next_event(event, &waited)) {
+                if (processed == 0) oldest_due->set(std::chrono::duration_cast<std::chrono::nanoseconds>(waited).count());   // The first one out waited longest
+                event_wait->record(waited);
+                process_event(event);
+                processed++;
+            }
 
-                // Iterate over the original command string and parse into a vector - words separated by spaces
-                while((c_position = c.find(' ')) != std::string::npos )
-                {   
-                    // If there's multiple words in the command then this gets called first
-                    v_command.push_back(c.substr(0, c_position));
-                    c = c.substr(c_position + 1);
-                }
-                v_command.push_back(c);
+            queue_depth->set(eq->size());
+            return processed;
+        };
 
-                #ifdef DEBUG
-                std::cout << "Processing command:  " << v_command[0] << std::endl;
-                #endif
+        // Dispatch the event to the handler for its kind
+        void process_event(tbdmud::event& event) {
+            std::visit([this] (auto& e) { handle_event(e); }, event);
+        };
 
-                /***** ?/HELP *****/
-                if ((v_command[0].at(0) == '?') || (boost::iequals(v_command[0], "help"))) {
-                    client->post("\nHelp - Valid Commands:\n");
-                    client->post("? or HELP       : help\n");
-                    client->post("who             : show connected players\n");
-                    client->post("look/l          : show room description\n");
-                    client->post("tell player ... : only player hears ...\n");
-                    client->post("say ...         : everyone in the room hears ...\n");
-                    client->post("shout ...       : everyone in the zone hears ...\n");
-                    client->post("broadcast ...   : everyone connected hears ...\n\n");
-                }
-                /***** who *****/
-                else if (boost::iequals(v_command[0], "who")) {
-                    client->post("\nConnected:\n");
-
-                    std::map<std::string, session*>::iterator c = char_to_client_map.begin();
-                    while (c != char_to_client_map.end()) {
-                        client->post(c->first + "\n");
-                        c++;
-                    }
-                    client->post("\n");
-                }
-                /***** look/l *****/
-                else if ((boost::iequals(v_command[0], "look")) || ((v_command.size() == 1) && boost::iequals(v_command[0], "l"))) {
-                    #ifdef DEBUG
-                    std::cout << "parsing look" << std::endl;
-                    std::cout << "current_room = " << pc->get_current_room() << std::endl;
-                    std::cout << "current_zone = " << pc->get_current_zone() << std::endl;
-                    #endif
-                    std::shared_ptr<room> current_room = find_room(pc->get_current_zone(), pc->get_current_room());
+        void handle_event(notice_event& event) {
+            const std::string& message = event.message.str();
+            std::cout << "NOTICE event:  " << message << std::endl;
 
-                    client->post("\nYou are in:  " + current_room->get_name() + "\n");
-                    client->post("exits:  " + current_room->get_exits_str() + "\n");
-                    client->post("\nStanding around:\n" + current_room->get_character_str() + "\n");
-                }
-                /***** tell <player> ... *****/
-                else if (boost::iequals(v_command[0], "tell")) {
-                    if(v_command.size() < 3) {
-                        client->post("Bad tell command format, expected:  tell player ...\n");
-                        break;
-                    }
+            // Broadcast to everyone in the world - these messages don't have an origin or specific target
+            shared_buffer notice = make_buffer("\n" + message + "\n\n");
+            std::unordered_map<symbol, online_character>::iterator ch = directory.begin();
+            while (ch != directory.end()) {
+                ch->second.client->post(notice);
+                ch++;
+            }
+        };
 
-                    std::shared_ptr<tbdmud::event_item> tell_event = std::shared_ptr<tbdmud::event_item>(new tbdmud::event_item());
-                    tell_event->set_origin(pc->get_name());
-                    tell_event->set_name("TELL");
-                    tell_event->set_type(tbdmud::event_type::SPEAK);
-                    tell_event->set_scope(tbdmud::event_scope::TARGET);
-
-                    // Check if the target player is connected
-                    std::shared_ptr<session> target;
-                    bool match = false;
-                    for(auto c : char_to_client_map)
-                    {
-                        if(c.second->get_player()->get_character()->get_name() == v_command[1]) {
-                            tell_event->set_target(v_command[1]);
-                            match = true;
+        void handle_event(speak_event& event) {
+            symbol                     origin        = event.origin;
+            symbol                     target        = event.target;
+            const std::string&         origin_name   = symbols().name(origin);     // Names are only looked up to render the text
+            const std::string&         target_name   = symbols().name(target);
+            const std::string&         message       = event.message.str();
+            session*                   origin_client = nullptr;
+            session*                   target_client = nullptr;
+            shared_buffer              heard;                                      // What everyone but the speaker sees, rendered once
+            std::unordered_map<symbol, online_character>::iterator ch;
+
+            origin_client = find_client(origin);
+            if (origin_client == nullptr) return;  // They disconnected before the event came due
+
+            switch(event.scope) {
+                case TARGET:  // TELL Event
+                    if (target != NO_SYMBOL) {
+                        std::cout << "TELL to " << target_name << ":  " << message << std::endl;
+                        target_client = find_client(target);
+
+                        // Write the messages out to the origin and target clients
+                        // (The target didn't ask for theirs, so it can be dropped like room chatter if they've stopped reading)
+                        if (target_client != nullptr) {
+                            target_client->post(make_buffer("\n" + origin_name + " tells you: " + message + "\n\n"), false);
+                            origin_client->post("\nYou tell " + target_name + ":  " + message + "\n\n");
                         }
-                    }
-
-                    if (match == false) {
-                        std::string error = "Player " + v_command[1] + " is not connected.\n"; 
-                        client->post(error);
-                        return;
-                    }
-
-                    // Chop the first word (the target name) off the remaining message, send the rest
-                    size_t space = message.find(" ");    
-                    if (space != std::string::npos) {
-                      message = message.substr(space + 1);
-                    }
-
-                    tell_event->set_message(tbdmud::event_scope::TARGET, message);
-                    std::cout << "tell event from " << tell_event->get_origin() << " to " << tell_event->get_target() << " : " << tell_event->get_message(tbdmud::event_scope::TARGET) << std::endl;
-                    eq->add_event(tell_event);
-                }
-                /***** say ... *****/
-                else if (boost::iequals(v_command[0], "say")) {
-                    if(v_command.size() < 2) {
-                        client->post("Bad say command format, expected:  say ...\n");
-                        break;
-                    }
-
-                    std::shared_ptr<tbdmud::event_item> say_event = std::shared_ptr<tbdmud::event_item>(new tbdmud::event_item());
-
-                    say_event->set_origin(client->get_player()->get_character()->get_name());
-                    say_event->set_name("SAY");
-                    say_event->set_type(tbdmud::event_type::SPEAK);
-                    say_event->set_scope(tbdmud::event_scope::ROOM);
-                    say_event->set_message(tbdmud::event_scope::ROOM, message);
-
-                    std::cout << "say event:  " << say_event->get_name() << ": " << say_event->get_message(tbdmud::event_scope::ROOM) << std::endl;
-                    eq->add_event(say_event);
-                }
-                /***** dsay ... *****/
-                // TODO:  Remove temporary command "say with delay" for testing event delays
-                else if (boost::iequals(v_command[0], "dsay")) {
-                    if(v_command.size() < 3) {
-                        client->post("Bad dsay command format, expected:  say # ...\n");
-                        break;
-                    }
-
-                    // Chop the first word (the delay time) off the remaining message, send the rest
-                    size_t space = message.find(" ");    
-                    if (space != std::string::npos) {
-                      message = message.substr(space + 1);
-                    }
-
-                    std::shared_ptr<tbdmud::event_item> dsay_event = std::shared_ptr<tbdmud::event_item>(new tbdmud::event_item());
-
-                    dsay_event->set_origin(client->get_player()->get_character()->get_name());
-                    dsay_event->set_name("DSAY");
-                    dsay_event->set_rtick(std::stoi(v_command[1]));
-                    dsay_event->set_type(tbdmud::event_type::SPEAK);
-                    dsay_event->set_scope(tbdmud::event_scope::ROOM);
-                    dsay_event->set_message(tbdmud::event_scope::ROOM, message);
-
-                    std::cout << "dsay event:  " << dsay_event->get_name() << " - " << dsay_event->get_rtick() << ":  " << dsay_event->get_message(tbdmud::event_scope::ROOM) << std::endl;
-                    eq->add_event(dsay_event);
-                }
-                /***** shout ... *****/
-                else if (boost::iequals(v_command[0], "shout")) {
-                    if(v_command.size() < 2) {
-                        client->post("Bad shout command format, expected:  shout # ...\n");
-                        break;
-                    }
-
-                    std::shared_ptr<tbdmud::event_item> shout_event = std::shared_ptr<tbdmud::event_item>(new tbdmud::event_item());
-
-                    shout_event->set_origin(client->get_player()->get_character()->get_name());
-                    shout_event->set_name("SHOUT");
-                    shout_event->set_type(tbdmud::event_type::SPEAK);
-                    shout_event->set_scope(tbdmud::event_scope::ZONE);
-                    shout_event->set_message(tbdmud::event_scope::ZONE, message);
-
-                    std::cout << "shout event:  " << shout_event->get_name() << ":  " << shout_event->get_message(tbdmud::event_scope::ZONE) << std::endl;
-                    eq->add_event(shout_event);
-                }
-                /***** broadcast ... *****/
-                else if (boost::iequals(v_command[0], "broadcast")) {
-                    if(v_command.size() < 2) {
-                        client->post("Bad broadcast command format, expected:  broadcast # ...\n");
-                        break;
-                    }
-                    std::shared_ptr<tbdmud::event_item> broadcast_event = std::shared_ptr<tbdmud::event_item>(new tbdmud::event_item());
-
-                    broadcast_event->set_origin(client->get_player()->get_character()->get_name());
-                    broadcast_event->set_name("BROADCAST");
-                    broadcast_event->set_type(tbdmud::event_type::SPEAK);
-                    broadcast_event->set_scope(tbdmud::event_scope::WORLD);
-                    broadcast_event->set_message(tbdmud::event_scope::WORLD, message);
-
-                    std::cout << "broadcast event:  " << broadcast_event->get_name() << ":  " << broadcast_event->get_message(tbdmud::event_scope::WORLD) << std::endl;
-                    eq->add_event(broadcast_event);
-                }
-                else {
-                    bool matches_exit = false;
-
-                    /***** move *****/
-                    // If the command is only one word, look to see if it matches one of the exits from the current room
-                    if(v_command.size() == 1) {
-                        std::shared_ptr<room> origin_room = find_room(pc->get_current_zone(), pc->get_current_room());
-                        std::map<std::string, std::shared_ptr<room>> exits = origin_room->get_exits();
-                        std::map<std::string, std::shared_ptr<room>>::iterator e = exits.begin();
-
-                        while (e != exits.end()) {
-                            #ifdef DEBUG
-                            std::cout << "move:  exits = " << e->first << ", " << e->second->get_name() << std::endl;
-                            #endif
-
-                            // If the first (and only) word of the command equals one of the exits from the current room, create a move event to that room
-                            if (boost::iequals(v_command[0],  e->first)) {
-                                matches_exit = true;
-                                std::shared_ptr<tbdmud::event_item> move_event = std::shared_ptr<tbdmud::event_item>(new tbdmud::event_item());
-
-                                move_event->set_origin(client->get_player()->get_character()->get_name());
-                                move_event->set_origin_room(origin_room->get_name());
-                                move_event->set_target_room(e->second->get_name());
-                                move_event->set_name("MOVE");
-                                move_event->set_type(tbdmud::event_type::MOVE);
-                                move_event->set_scope(tbdmud::event_scope::ROOM);
-
-                                #ifdef DEBUG
-                                std::cout << "move event:  move " << move_event->get_origin() << " from " << move_event->get_origin_room() << " to " << move_event->get_target_room() << std::endl;
-                                #endif
-                                eq->add_event(move_event);
-                            }
-                            e++;
+                        else {
+                            origin_client->post("Player " + target_name + " is not connected.\n");
                         }
-
                     }
-
-                    if (!matches_exit) {
-                        #ifdef DEBUG
-                        std::cout << "\nUnknown command or exit\n" << std::endl;
-                        #endif
-                        client->post("\nUnknown command or exit\n");
+                    else {
+                        std::cout << "Error - Malformed TELL event\n" << std::endl;
                     }
-                }
-            }  // end for (commands)
-        }; // end command_parse()
-
-        /***********************************************************************************************
-         * EVENT PROCESSOR
-         * Take an event and decode the event type, scope, and other parameters to determine the actions
-         * the world should take in response (sending a message to a client's screen, moving a character
-         * from one room to another, etc)
-         ***********************************************************************************************/  
-        void process_events() {
-            // Grab the event at the top of the event queue
-            std::shared_ptr<event_item>        event = eq->next_event();
-            if (event == nullptr) return;  // The queue will return nullptr if there are no events that need processing
 
-            // We have to define all these here because we can't do it inside the case statment
-            std::string                origin_name;
-            session*                   origin_client    = nullptr;
-            std::shared_ptr<character> origin_char      = nullptr;
-            std::shared_ptr<zone>      origin_zone      = nullptr;
-            std::string                origin_room_name;
-            std::shared_ptr<room>      origin_room      = nullptr; 
-            std::string                target_name;
-            session*                   target_client    = nullptr;
-            std::shared_ptr<character> target_char      = nullptr;
-            std::shared_ptr<zone>      target_zone      = nullptr; 
-            std::string                target_room_name;
-            std::shared_ptr<room>      target_room      = nullptr; 
-            std::string                message;
-            std::map<std::string, session*>::iterator  ch;
+                    break;
+                case WORLD:  // Broadcast Event
+                    std::cout << "BROADCAST event:  " << message << std::endl;
 
-            if (event == nullptr) {
-                std::cout << "Error - NULL event" << std::endl; 
-            }
-            else {
-                switch(event->get_type()) {
-                    case NOTICE:
-                        // Get the relevant fields for NOTICE events
-                        origin_name      = event->get_origin();
-
-                        message = event->get_message(event_scope::WORLD);
-                        std::cout << "NOTICE event:  " << message << std::endl;
-
-                        // Broadcast to everyone in the world - these messages don't have an origin or specific target
-                        ch = char_to_client_map.begin();
-                        while (ch != char_to_client_map.end()) {
-                            std::string target_name = ch->first;
-                            ch->second->post("\n" + message + "\n\n");
-                            ch++;
+                    // Broadcast to everyone else in the world what the origin player said
+                    heard = make_buffer("\n" + origin_name + " broadcasts:  " + message + "\n\n");
+                    ch = directory.begin();
+                    while (ch != directory.end()) {
+                        if (ch->first != origin) {
+                            ch->second.client->post(heard);
                         }
-
-                        break;
-                    case SPEAK:
-                        // Get the relevant fields for SPEAK events
-                        origin_name      = event->get_origin();
-                        origin_room_name = event->get_origin_room();
-                        target_name      = event->get_target();
-                        target_room_name = event->get_target_room();
-
-                        // TODO:  develop a better way to get the character pointer given the character name
-                        if (origin_name != "") {
-                            origin_char = char_to_client_map[origin_name]->get_player()->get_character();
-                            origin_client = char_to_client_map[origin_name];
+                        else {
+                            origin_client->post("\nYou broadcast:  " + message + "\n\n");
                         }
+                        ch++;
+                    }
 
-                        switch(event->get_scope()) {
-                            case TARGET:  // TELL Event
-                                if ((origin_name != "") && (target_name != "")) {
-                                    std::cout << "TELL to " << target_name << ":  " << event->get_message(TARGET) << std::endl;
-                                    target_char = char_to_client_map[target_name]->get_player()->get_character();
-                                    target_client = char_to_client_map[target_name];
-
-                                    // Write the messages out to the origin and target clients
-                                    if (target_client != nullptr) {
-                                        target_client->post("\n" + origin_name + " tells you: " + event->get_message(TARGET) + "\n\n");
-                                    }
-                                    if (origin_client != nullptr) {
-                                        origin_client->post("\nYou tell " + target_name + ":  " + event->get_message(TARGET) + "\n\n");
-                                    }
-                                }
-                                else {
-                                    std::cout << "Error - Malformed TELL event\n" << std::endl;
-                                }
-
-                                break;
-                            case ROOM:  // SAY Event
-                                message = event->get_message(event_scope::ROOM);
-                                std::cout << "SAY event:  " << message << std::endl;
-
-                                origin_room = find_room(origin_char->get_current_zone(), origin_char->get_current_room());
-                                
-                                // Broadcast to everyone else in the room what the origin player said
-                                for (std::shared_ptr<character> ch : origin_room->get_characters()) {
-                                    if (ch->get_name() != origin_name) {
-                                        char_to_client_map[ch->get_name()]->post("\n" + origin_name + " says:  " + message + "\n\n");
-                                    }
-                                    else {
-                                        origin_client->post("\nYou say:  " + message + "\n\n");
-                                    }
-                                }
-
-                                break;
-                            case ZONE:  // Shout Event
-                                message = event->get_message(event_scope::ZONE);
-                                std::cout << "SHOUT event:  " << message << std::endl;
-
-                                origin_zone = find_zone(origin_char->get_current_zone());
-                                
-                                // Broadcast to everyone else in the zone what the origin player said
-                                for (std::shared_ptr<character> ch : origin_zone->get_characters()) {
-                                    if (ch->get_name() != origin_name) {
-                                        char_to_client_map[ch->get_name()]->post("\n" + origin_name + " shouts:  " + message + "\n\n");
-                                    }
-                                    else {
-                                        origin_client->post("\nYou shout:  " + message + "\n\n");
-                                    }
-                                }
-
-                                break;
-                            case WORLD:  // Broadcast Event
-                                message = event->get_message(event_scope::WORLD);
-                                std::cout << "BROADCAST event:  " << message << std::endl;
-
-                                // Broadcast to everyone else in the world what the origin player said
-                                ch = char_to_client_map.begin();
-                                while (ch != char_to_client_map.end()) {
-                                    std::string target_name = ch->first;
-                                    if (target_name != origin_name) {
-                                        ch->second->post("\n" + origin_name + " broadcasts:  " + message + "\n\n");
-                                    }
-                                    else {
-                                        origin_client->post("\nYou broadcast:  " + message + "\n\n");
-                                    }
-                                    ch++;
-                                }
-
-                                break;
-                            default:
-                                std::cout << "Error - Unknown SPEAK event:  " << event->get_name() << std::endl;
-                                break;
-                        }
-                        break;
-                    case MOVE:
-                        // Get the relevant fields for MOVE events
-                        origin_name      = event->get_origin();
-                        origin_room_name = event->get_origin_room();
-                        target_room_name = event->get_target_room();
-
-                        // TODO:  develop a better way to get the character pointer given the character name
-                        if (origin_name != "") {
-                            origin_char = char_to_client_map[origin_name]->get_player()->get_character();
-                            origin_client = char_to_client_map[origin_name];
-                        }
+                    break;
+                default:
+                    std::cout << "Error - SPEAK event scope " << event.scope << " is handled by the zones, not the world" << std::endl;
+                    break;
+            }
+        };
 
-                        if (origin_room_name != "" && target_room_name != "") {
-                            // TODO:  Handle moving from one zone to another
-                            //origin_zone = find_zone(origin_char->get_current_zone());
-                            origin_room = find_room(origin_char->get_current_zone(), origin_room_name);
-                            target_room = find_room(origin_char->get_current_zone(), target_room_name);
-                            std::cout << "MOVE event:  move " << origin_name << " from " << origin_room_name << " to " << target_room_name << std::endl;
-
-                            // Broadcast to everyone else in the origin room that the player left
-                            for (std::shared_ptr<character> ch : origin_room->get_characters()) {
-                                if (ch->get_name() != origin_name) {
-                                    char_to_client_map[ch->get_name()]->post("\n" + origin_name + " left the room towards " + target_room_name + "\n\n");
-                                }
-                                else {
-                                    origin_client->post("\nYou left the room\n\n");
-                                }
-                            }
-
-                            // Actually perform the room transition
-                            origin_room->leave_room(origin_char);
-                            target_room->enter_room(origin_char);
-
-                            // Broadcast to everyone else in the target room that the player has arrived
-                            for (std::shared_ptr<character> ch : target_room->get_characters()) {
-                                if (ch->get_name() != origin_name) {
-                                    char_to_client_map[ch->get_name()]->post("\n" + origin_name + " has entered the room\n\n");
-                                }
-                                else {
-                                    origin_client->post("\nYou have entered " + target_room_name + "\n\n");
-                                }
-                            }
-                        }
-                        else {
-                            std::cout << "Error - Malformed MOVE event\n" << std::endl;
-                        }
-                        break;
-                    default:
-                        std::cout << "Unknown event:  " << event->get_name() << std::endl;
-                        break;
-                }
+        // A character has left a room in one zone for a room in another - point the directory at the new zone's shard and hand them to it
+        void handle_event(move_event& event) {
+            std::unordered_map<symbol, online_character>::iterator i = directory.find(event.origin);
+            if (i == directory.end()) return;  // They disconnected on the way
+
+            shard* target = find_shard(event.target_zone);
+            if (target == nullptr) {
+                // Nowhere to go, put them back where they came from
+                std::cout << "Error - MOVE to unknown zone " << symbols().name(event.target_zone) << std::endl;
+                target = i->second.home;
+                event.target_zone = event.origin_zone;
+                event.target_room = event.origin_room;
+                event.origin_zone = NO_SYMBOL;
             }
+
+            i->second.home = target;
+            target->deliver(mail{event, i->second.client});
         };
 };
 
+// A shard's calls into the world (they hop onto the world's strand, except looking names up)
+inline symbol shard::find_online(std::string_view name) {
+    return w->get_online().find(name);
+}
+
+inline void shard::send_to_world(mail&& m) {
+    w->deliver(std::move(m));
+}
+
+inline void shard::reroute(std::shared_ptr<session> client, std::string line, std::chrono::steady_clock::time_point received) {
+    world* wp = w;
+    io::post(w->get_strand(), [wp, client, line = std::move(line), received] () mutable { wp->command_parse(client, std::move(line), received); });
+}
+
+/***** copyover *****/
+// Restart the server binary without dropping anyone (admins only)
+inline void shard::do_copyover(std::shared_ptr<session> client, const command& /*cmd*/, symbol /*name*/) {
+    if (!client->get_player()->is_admin()) {
+        client->post("\nUnknown command or exit\n");
+        return;
+    }
+
+    std::cout << client->get_player()->get_name() << " asked for a copyover" << std::endl;
+    world* wp = w;
+    io::post(w->get_strand(), [wp] { wp->request_copyover(); });
+}
+
+inline void shard::save_location(std::shared_ptr<character> c, std::shared_ptr<room> r) {
+    w->get_store().character_moved(c->get_name(), z->get_name(), r->get_name());
+}
+
+// The account has their location in it, so once it's on disk the world store can forget them
+inline void shard::save_account(player_account account) {
+    world* wp = w;
+    std::string name = account.name;
+    wp->get_accounts().save(std::move(account), [wp, name] { wp->get_store().character_saved(name); });
+}
+
+inline void shard::list_players(std::shared_ptr<session> client) {
+    world* wp = w;
+    io::post(w->get_strand(), [wp, client] { wp->list_players(client); });
+}
+
 }  // end namespace tbdmud
 
 #endif
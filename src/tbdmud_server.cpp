@@ -2,11 +2,26 @@
 #include <boost/asio.hpp>
 #include <boost/bind/bind.hpp>
 #include <boost/algorithm/string.hpp>
+#include <charconv>
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
 #include <optional>
 #include <queue>
+#include <thread>
 #include <unordered_set>
 #include <events.h>
+#include <tokenizer.h>
+#include <commands.h>
+#include <area_image.h>
+#include <persistence.h>
+#include <players.h>
+#include <online.h>
 #include <entities.h>
+#include <metrics.h>
+#include <telnet.h>
+#include <copyover.h>
 #include <session.h>
 #include <world.h>
 #include <tbdmud_server.h>
@@ -15,40 +30,151 @@
 void async_tick(const boost::system::error_code& /*e*/, io::steady_timer* t, tbdmud::world* w)
 {
     w->tick();
+    w->process_events();  // Handle the delayed events that became due on this tick
 
     // Move the expiration time of our timer up by one second and set it again
     t->expires_at(t->expiry() + io::chrono::seconds(1));
     t->async_wait(boost::bind(async_tick, io::placeholders::error, t, w));
 }
 
-// Handle events from the queue that precede or are equal to the current time
-void async_handle_queue(const boost::system::error_code& /*e*/, io::deadline_timer* t, tbdmud::world* w)
+// Handle every event from the queue that precedes or is equal to the current time
+void async_handle_queue(bool* pending, tbdmud::world* w)
 {
+    *pending = false;  // Clear first so events added while we're draining schedule another pass
     w->process_events();
-
-    // Move the expiration time of our timer up by one millisecond and set it again
-    t->expires_from_now(boost::posix_time::milliseconds(1));                              // Run as often as possible
-    t->async_wait(boost::bind(async_handle_queue, io::placeholders::error, t, w));
 }
 
-int main()
+// Usage:  tbdmud_server [number of I/O threads] [area image] [data directory] [metrics port (0 turns the endpoint off)]
+//                       [MCCP2 compression level, 1-9 (0 turns it off)]
+//                       [outbound queue limit, KB] [outbound queue limit, messages] [outbound hard limit, KB] [overflow policy:  drop, collapse or disconnect]
+// An admin's copyover command (or SIGUSR1) re-executes the binary with the same arguments, handing the connections over to it
+int main(int argc, char* argv[])
 {
-    io::io_context io_context;
-    io::steady_timer   ticktimer(io_context,  io::chrono::seconds(1));
-    io::deadline_timer queuetimer(io_context);
-    tbdmud::world world;
+    std::string binary = std::filesystem::read_symlink("/proc/self/exe");   // Before it's replaced, a copyover runs whatever is at this path then
+
+    // Started by a copyover - the connections are already open, the handoff file says whose they are
+    // (This comes before anything else is opened, so if the file can't be read every other descriptor is one that was handed over)
+    std::optional<tbdmud::copyover_state> inherited;
+    int inherited_listener = -1;
+    if (const char* env = std::getenv(tbdmud::COPYOVER_ENV)) {
+        std::string handoff_path;
+        tbdmud::parse_copyover_env(env, inherited_listener, handoff_path);
+        inherited.emplace();
+        if (tbdmud::copyover_file::read(handoff_path, *inherited)) {
+            if (inherited_listener < 0) inherited_listener = inherited->listener;
+        }
+        else {
+            std::cout << "Copyover:  can't read " << handoff_path << ", closing the connections that were handed over" << std::endl;
+            inherited.reset();
+            tbdmud::close_inherited_fds(inherited_listener);
+        }
+        std::remove(handoff_path.c_str());
+        unsetenv(tbdmud::COPYOVER_ENV);
+    }
+
+    uint num_threads = (argc > 1) ? std::max(1, std::atoi(argv[1])) : 1;
+    std::string area_path = (argc > 2) ? argv[2] : "areas/world.img";
+    std::string data_path = (argc > 3) ? argv[3] : "data";
+    uint metrics_port = (argc > 4) ? std::atoi(argv[4]) : 15002;
+    int compression_level = (argc > 5) ? std::clamp(std::atoi(argv[5]), 0, 9) : 6;
+    outbound_limits limits;                                               // Each session's outbound queue (the defaults are in session.h)
+    if (argc > 6) limits.max_bytes    = (size_t) std::max(1, std::atoi(argv[6])) * 1024;
+    if (argc > 7) limits.max_messages = std::max(1, std::atoi(argv[7]));
+    if (argc > 8) limits.hard_bytes   = (size_t) std::max(1, std::atoi(argv[8])) * 1024;
+    limits.hard_bytes = std::max(limits.hard_bytes, limits.max_bytes);
+    if ((argc > 9) && !parse_overflow_policy(argv[9], limits.policy)) {
+        std::cout << "Unknown overflow policy " << argv[9] << " (drop, collapse or disconnect)" << std::endl;
+        return 1;
+    }
+    io::io_context io_context(num_threads);
+    world_strand       strand(io_context.get_executor());                // The world, its timers and the server's client list only run on this strand
+    io::steady_timer   ticktimer(strand,  io::chrono::seconds(1));
+    tbdmud::world world(strand);                                          // Each zone gets its own strand on the same io_context
+    if (!world.load_areas(area_path)) return 1;
+    if (!world.open_store(data_path)) return 1;
+    io::signal_set     signals(strand, SIGINT, SIGTERM);                   // Stop cleanly, so everything gets saved
+    bool queue_pending = false;  // Set while a queue drain is already scheduled, so a burst of events only posts one
 
-    server srv(io_context, 15001, &world);
+    std::optional<server> listening;
+    try {
+        listening.emplace(io_context, strand, 15001, &world, inherited_listener);
+    }
+    catch (const boost::system::system_error& e) {
+        std::cout << "Can't listen on port 15001:  " << e.what() << std::endl;
+        return 1;
+    }
+    server& srv = *listening;
+    srv.set_compression_level(compression_level);
+    srv.set_outbound_limits(limits);
+    if (inherited) srv.restore(*inherited);
+    std::optional<tbdmud::metrics_endpoint> metrics_endpoint;                // Prometheus scrapes it, on the loopback address only
+    try {
+        if (metrics_port != 0) metrics_endpoint.emplace(io_context, metrics_port);
+    }
+    catch (const boost::system::system_error& e) {
+        // The game goes on without it (after a copyover the players are already connected)
+        std::cout << "Can't serve metrics on port " << metrics_port << ":  " << e.what() << std::endl;
+    }
 
     // Tasks to be asynchronously run by the server
     srv.async_accept();                                                                           // Asynchronously accept incoming TCP traffic
     ticktimer.async_wait(boost::bind(async_tick, io::placeholders::error, &ticktimer, &world));   // Asynchronously but regularly trigger a tick update
-    queuetimer.expires_from_now(boost::posix_time::milliseconds(100));                            // Run as often as possible, it's fine if queue handling longer than this to run
-    queuetimer.async_wait(boost::bind(async_handle_queue, io::placeholders::error, &queuetimer, &world));
+    signals.async_wait([&] (const error_code& /*error*/, int signal) {
+        std::cout << "Shutting down on signal " << signal << std::endl;
+        io_context.stop();
+    });
+
+    // A copyover stops the io_context once the clients' output has drained, and the connections are handed over below
+    bool copyover = false;
+    io::signal_set copyover_signal(strand, SIGUSR1);
+    world.set_copyover_handler([&] {
+        srv.begin_copyover([&] {
+            copyover = true;
+            io_context.stop();
+        });
+    });
+    copyover_signal.async_wait([&] (const error_code& error, int /*signal*/) {
+        if (!error) world.request_copyover();
+    });
+
+    // Immediate events wake the queue handler up instead of polling for them
+    // (Events are only added on the world's strand, so the drain is posted to it as well)
+    world.set_event_ready_handler([&] {
+        if (queue_pending) return;
+        queue_pending = true;
+        io::post(strand, boost::bind(async_handle_queue, &queue_pending, &world));
+    });
+
+    // Invoke the completion handlers - the world and each zone run on their own strands, and the sessions' socket I/O is spread across the threads
+    std::cout << "Running with " << num_threads << " I/O thread(s)" << std::endl;
+    std::vector<std::thread> threads;
+    for (uint i = 1; i < num_threads; i++) {
+        threads.emplace_back([&io_context] { io_context.run(); });
+    }
+    io_context.run();
+
+    for (std::thread& t : threads) {
+        t.join();
+    }
+
+    world.save_to_disk();   // The world is a separate top-level object so it can ensure all the data is saved to disk before the program exits
+
+    if (copyover) {
+        tbdmud::copyover_state state = srv.handoff();
+        std::string handoff_path = data_path + "/copyover";
+        if (!tbdmud::copyover_file::write(handoff_path, state)) {
+            std::cout << "Copyover:  can't write " << handoff_path << std::endl;
+            return 1;
+        }
 
-    io_context.run();  // Invoke the completion handlers
+        tbdmud::prepare_copyover_exec(state);
+        setenv(tbdmud::COPYOVER_ENV, tbdmud::copyover_env(state.listener, handoff_path).c_str(), 1);
+        std::cout << "Copyover:  restarting " << binary << " with " << state.sessions.size() << " connection(s)" << std::endl;
+        execv(binary.c_str(), argv);
 
-    //world.save_to_disk;   // TODO: The world is a separate top-level object so it can ensure all the data is saved to disk before the program exits
+        std::cout << "Copyover:  can't run " << binary << ":  " << std::strerror(errno) << std::endl;
+        return 1;
+    }
 
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,267 @@
+// The area compiler - turns text area files into the binary image the server maps at startup
+// Usage:  areac <output image> <area file> [<area file> ...]
+//
+// Area file format (one directive per line, # starts a comment):
+//   zone <name>                   Start a new zone, the rooms that follow belong to it
+//   start <room>                  The room new characters start in (defaults to the zone's first room)
+//   room <name>                   Start a new room in the current zone
+//   exit <name> <room>            An exit from the current room to a room in the same zone
+//   exit <name> <zone>/<room>     An exit from the current room to a room in another zone
+//
+// The first zone compiled is the one new characters start in
+
+#include <iostream>
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <area_image.h>
+
+using namespace tbdmud;
+
+// Where a directive came from, for error messages
+struct source_line {
+    std::string file;
+    uint        line = 0;
+};
+
+struct exit_def {
+    std::string name;
+    std::string target_zone;   // Empty for the zone the exit is in
+    std::string target_room;
+    source_line where;
+};
+
+struct room_def {
+    std::string           name;
+    std::vector<exit_def> exits;
+    source_line           where;
+};
+
+struct zone_def {
+    std::string           name;
+    std::string           start;
+    std::vector<room_def> rooms;
+    source_line           where;
+};
+
+static bool failed = false;
+
+void error(const source_line& where, const std::string& message) {
+    std::cerr << where.file << ":" << where.line << ":  " << message << std::endl;
+    failed = true;
+}
+
+// Read one area file, adding its zones to the list
+void read_area(const std::string& path, std::vector<zone_def>& zones) {
+    std::ifstream in(path);
+    if (!in) {
+        std::cerr << "areac:  can't open " << path << std::endl;
+        failed = true;
+        return;
+    }
+
+    std::string text;
+    source_line where;
+    where.file = path;
+
+    while (std::getline(in, text)) {
+        where.line++;
+
+        size_t comment = text.find('#');
+        if (comment != std::string::npos) text.erase(comment);
+
+        std::istringstream words(text);
+        std::string directive, name, target, extra;
+        if (!(words >> directive)) continue;  // Blank line
+        words >> name >> target >> extra;
+
+        if (directive == "zone") {
+            if (name.empty() || !target.empty()) { error(where, "expected:  zone <name>"); continue; }
+            zones.push_back(zone_def());
+            zones.back().name  = name;
+            zones.back().where = where;
+        }
+        else if (zones.empty()) {
+            error(where, "'" + directive + "' before the first zone");
+        }
+        else if (directive == "start") {
+            if (name.empty() || !target.empty()) { error(where, "expected:  start <room>"); continue; }
+            zones.back().start = name;
+        }
+        else if (directive == "room") {
+            if (name.empty() || !target.empty()) { error(where, "expected:  room <name>"); continue; }
+            zones.back().rooms.push_back(room_def());
+            zones.back().rooms.back().name  = name;
+            zones.back().rooms.back().where = where;
+        }
+        else if (directive == "exit") {
+            if (name.empty() || target.empty() || !extra.empty()) { error(where, "expected:  exit <name> [<zone>/]<room>"); continue; }
+            if (zones.back().rooms.empty()) { error(where, "exit before the first room of zone " + zones.back().name); continue; }
+
+            exit_def e;
+            e.name  = name;
+            e.where = where;
+            size_t slash = target.find('/');
+            if (slash != std::string::npos) {
+                e.target_zone = target.substr(0, slash);
+                e.target_room = target.substr(slash + 1);
+            }
+            else {
+                e.target_room = target;
+            }
+            zones.back().rooms.back().exits.push_back(e);
+        }
+        else {
+            error(where, "unknown directive '" + directive + "'");
+        }
+    }
+}
+
+// Builds the string pool, storing each distinct string once
+class string_pool {
+    private:
+        std::string                                   pool;
+        std::unordered_map<std::string, area_string>  seen;
+
+    public:
+        area_string add(const std::string& s) {
+            std::unordered_map<std::string, area_string>::iterator i = seen.find(s);
+            if (i != seen.end()) return i->second;
+
+            area_string ref = {(uint32_t) pool.size(), (uint32_t) s.size()};
+            pool += s;
+            seen.insert({s, ref});
+            return ref;
+        }
+
+        const std::string& data() {
+            return pool;
+        }
+};
+
+int main(int argc, char* argv[]) {
+    if (argc < 3) {
+        std::cerr << "Usage:  areac <output image> <area file> [<area file> ...]" << std::endl;
+        return 2;
+    }
+
+    std::vector<zone_def> zones;
+    for (int i = 2; i < argc; i++) {
+        read_area(argv[i], zones);
+    }
+    if (zones.empty() && !failed) {
+        std::cerr << "areac:  no zones defined" << std::endl;
+        failed = true;
+    }
+    if (failed) return 1;
+
+    // Number every zone and room, so the exits can be resolved to room indexes
+    std::unordered_map<std::string, uint32_t>                             zone_index;
+    std::vector<std::unordered_map<std::string, uint32_t>>                room_index(zones.size());
+    uint32_t num_rooms = 0;
+    uint32_t num_exits = 0;
+
+    for (uint32_t z = 0; z < zones.size(); z++) {
+        if (!zone_index.insert({zones[z].name, z}).second) error(zones[z].where, "zone " + zones[z].name + " is defined twice");
+        if (zones[z].rooms.empty()) error(zones[z].where, "zone " + zones[z].name + " has no rooms");
+
+        for (room_def& r : zones[z].rooms) {
+            if (!room_index[z].insert({r.name, num_rooms}).second) error(r.where, "room " + r.name + " is defined twice in zone " + zones[z].name);
+            num_rooms++;
+            num_exits += r.exits.size();
+        }
+    }
+    if (failed) return 1;
+
+    // Fill in the tables
+    string_pool             strings;
+    std::vector<area_zone>  zone_table;
+    std::vector<area_room>  room_table;
+    std::vector<area_exit>  exit_table;
+
+    for (uint32_t z = 0; z < zones.size(); z++) {
+        zone_def& zd = zones[z];
+        area_zone az;
+        az.name       = strings.add(zd.name);
+        az.first_room = room_table.size();
+        az.num_rooms  = zd.rooms.size();
+        az.start_room = az.first_room;
+
+        if (!zd.start.empty()) {
+            std::unordered_map<std::string, uint32_t>::iterator s = room_index[z].find(zd.start);
+            if (s != room_index[z].end()) az.start_room = s->second;
+            else error(zd.where, "start room " + zd.start + " isn't in zone " + zd.name);
+        }
+        zone_table.push_back(az);
+
+        for (room_def& rd : zd.rooms) {
+            // Exits are shown to players in the order they're stored, so sort them by name
+            std::stable_sort(rd.exits.begin(), rd.exits.end(), [] (const exit_def& a, const exit_def& b) { return a.name < b.name; });
+            for (size_t i = 1; i < rd.exits.size(); i++) {
+                if (rd.exits[i].name == rd.exits[i - 1].name) error(rd.exits[i].where, "room " + rd.name + " already has an exit named " + rd.exits[i].name);
+            }
+
+            area_room ar;
+            ar.name       = strings.add(rd.name);
+            ar.zone       = z;
+            ar.first_exit = exit_table.size();
+            ar.num_exits  = rd.exits.size();
+            room_table.push_back(ar);
+
+            for (exit_def& ed : rd.exits) {
+                uint32_t tz = z;
+                if (!ed.target_zone.empty()) {
+                    std::unordered_map<std::string, uint32_t>::iterator i = zone_index.find(ed.target_zone);
+                    if (i == zone_index.end()) { error(ed.where, "no zone named " + ed.target_zone); continue; }
+                    tz = i->second;
+                }
+
+                std::unordered_map<std::string, uint32_t>::iterator t = room_index[tz].find(ed.target_room);
+                if (t == room_index[tz].end()) { error(ed.where, "no room named " + ed.target_room + " in zone " + zones[tz].name); continue; }
+
+                area_exit ae;
+                ae.name        = strings.add(ed.name);
+                ae.target_room = t->second;
+                exit_table.push_back(ae);
+            }
+        }
+    }
+    if (failed) return 1;
+
+    // Lay the image out:  header, zones, rooms, exits, strings
+    area_header h = {};
+    std::memcpy(h.magic, AREA_IMAGE_MAGIC, sizeof(h.magic));
+    h.version        = AREA_IMAGE_VERSION;
+    h.num_zones      = zone_table.size();
+    h.num_rooms      = room_table.size();
+    h.num_exits      = exit_table.size();
+    h.zones_offset   = sizeof(area_header);
+    h.rooms_offset   = h.zones_offset + zone_table.size() * sizeof(area_zone);
+    h.exits_offset   = h.rooms_offset + room_table.size() * sizeof(area_room);
+    h.strings_offset = h.exits_offset + exit_table.size() * sizeof(area_exit);
+    h.strings_size   = strings.data().size();
+
+    // Write to a temporary file and rename it over the output, so a running server never sees half an image
+    std::string output = argv[1];
+    std::string temp   = output + ".tmp";
+    std::ofstream out(temp, std::ios::binary | std::ios::trunc);
+    out.write(reinterpret_cast<const char*>(&h), sizeof(h));
+    out.write(reinterpret_cast<const char*>(zone_table.data()), zone_table.size() * sizeof(area_zone));
+    out.write(reinterpret_cast<const char*>(room_table.data()), room_table.size() * sizeof(area_room));
+    out.write(reinterpret_cast<const char*>(exit_table.data()), exit_table.size() * sizeof(area_exit));
+    out.write(strings.data().data(), strings.data().size());
+    out.close();
+
+    if (!out || (std::rename(temp.c_str(), output.c_str()) != 0)) {
+        std::cerr << "areac:  can't write " << output << std::endl;
+        std::remove(temp.c_str());
+        return 1;
+    }
+
+    std::cout << "areac:  " << h.num_zones << " zones, " << h.num_rooms << " rooms, " << h.num_exits << " exits -> " << output
+              << " (" << h.strings_offset + h.strings_size << " bytes)" << std::endl;
+    return 0;
+}
@@ -0,0 +1,493 @@
+// A headless load generator - opens lots of telnet connections to a server on this box, logs each one in, and sends a scripted mix
+// of commands at a steady rate, timing how long each one takes to come back (the command's own echo, not just any output)
+// Usage:  loadgen [options]   (loadgen --help lists them)
+//
+// Each client has one command outstanding at a time, sent on a Poisson schedule at the rate asked for (so a slow server shows up as
+// latency, and as a lower rate than asked for).  Only commands sent after the connections have ramped up are counted.
+
+#include <iostream>
+#include <boost/asio.hpp>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <iomanip>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/resource.h>
+
+namespace io = boost::asio;
+using tcp = io::ip::tcp;
+using error_code = boost::system::error_code;
+using steady = std::chrono::steady_clock;
+
+enum command_kind {
+    SAY,
+    SHOUT,
+    TELL,
+    LOOK,
+    MOVE,
+    NUM_KINDS
+};
+
+const char* kind_names[NUM_KINDS] = {"say", "shout", "tell", "look", "move"};
+
+struct options {
+    std::string host      = "127.0.0.1";
+    uint16_t    port      = 15001;
+    uint        clients   = 100;
+    double      rate      = 1.0;      // Commands a second, per client
+    double      ramp      = 5.0;      // Seconds to spread the connections over (not measured)
+    double      duration  = 30.0;     // Seconds to measure for, after the ramp
+    double      timeout   = 10.0;     // Seconds to wait for an echo before giving up on it
+    uint        threads   = 2;
+    std::string prefix    = "lg";     // Clients log in as <prefix><number>
+    uint        weights[NUM_KINDS] = {40, 5, 10, 25, 20};   // The command mix
+};
+
+// What each client measured - kept per client so the I/O threads never share anything, and merged at the end
+struct client_stats {
+    std::vector<uint32_t> latency[NUM_KINDS];     // Microseconds from sending a command to its echo
+    std::vector<uint32_t> login_latency;          // From connecting to seeing the room
+    uint64_t              sent     = 0;
+    uint64_t              echoed   = 0;
+    uint64_t              timeouts = 0;
+};
+
+struct load_counters {
+    std::atomic<uint64_t> connected{0};
+    std::atomic<uint64_t> logged_in{0};
+    std::atomic<uint64_t> connect_failures{0};
+    std::atomic<uint64_t> login_failures{0};
+    std::atomic<uint64_t> disconnects{0};
+    std::atomic<uint64_t> bytes_received{0};
+    std::atomic<bool>     stopping{false};
+};
+
+class client : public std::enable_shared_from_this<client> {
+    private:
+        const options&            opt;
+        load_counters&            counters;
+        uint                      id;
+        steady::time_point        measure_from;          // Commands sent before this (during the ramp) aren't counted
+        tcp::socket               socket;
+        io::steady_timer          timer;
+        std::string               name;
+        std::string               inbox;                 // What's come in that we haven't matched yet
+        std::string               outgoing;              // The line being written (only ever one at a time)
+        char                      buffer[8192];
+        std::mt19937              rng;
+        bool                      logged_in = false;
+        bool                      waiting   = false;     // Waiting for a command's echo
+        command_kind              kind      = SAY;
+        std::string               marker;                // What the echo looks like
+        std::string               other_marker;          // Another answer that counts as the echo (a failed move or tell)
+        steady::time_point        connected_at;
+        steady::time_point        sent_at;
+        steady::time_point        next_send;
+        uint64_t                  seq = 0;
+
+    public:
+        client_stats              stats;
+
+        client(io::io_context& io_context, const options& o, load_counters& c, uint i, steady::time_point m)
+            : opt(o), counters(c), id(i), measure_from(m), socket(io::make_strand(io_context)), timer(socket.get_executor()), rng(i * 7919 + 1) {
+            name = opt.prefix + std::to_string(id);
+        }
+
+        void start(tcp::endpoint endpoint) {
+            std::shared_ptr<client> self = shared_from_this();
+            connected_at = steady::now();
+            socket.async_connect(endpoint, [this, self] (error_code error) {
+                if (error) {
+                    counters.connect_failures++;
+                    return;
+                }
+                counters.connected++;
+                socket.set_option(tcp::no_delay(true));
+                read();
+            });
+        }
+
+        void stop() {
+            std::shared_ptr<client> self = shared_from_this();
+            io::post(socket.get_executor(), [this, self] {
+                timer.cancel();
+                error_code ignored;
+                socket.close(ignored);
+            });
+        }
+
+    private:
+        void read() {
+            std::shared_ptr<client> self = shared_from_this();
+            socket.async_read_some(io::buffer(buffer), [this, self] (error_code error, size_t n) {
+                if (error) {
+                    if (!counters.stopping) counters.disconnects++;
+                    timer.cancel();
+                    return;
+                }
+
+                counters.bytes_received += n;
+                inbox.append(buffer, n);
+                on_input();
+                read();
+            });
+        }
+
+        void write(std::string line) {
+            outgoing = std::move(line);
+            std::shared_ptr<client> self = shared_from_this();
+            io::async_write(socket, io::buffer(outgoing), [this, self] (error_code error, size_t) {
+                if (error) socket.close(error);
+            });
+        }
+
+        void on_input() {
+            if (!logged_in) {
+                if (inbox.find(" is already in use") != std::string::npos) {
+                    counters.login_failures++;
+                    error_code ignored;
+                    socket.close(ignored);
+                    return;
+                }
+
+                if (inbox.find("Enter username: --> ") != std::string::npos) {
+                    inbox.clear();
+                    write(name + "\r\n");
+                    return;
+                }
+
+                // Logging in shows them the room they're in
+                if (inbox.find("You are in:  ") != std::string::npos) {
+                    logged_in = true;
+                    counters.logged_in++;
+                    stats.login_latency.push_back(micros(steady::now() - connected_at));
+                    inbox.clear();
+                    next_send = steady::now();
+                    schedule();
+                }
+                return;
+            }
+
+            if (!waiting) {
+                inbox.clear();   // Other players talking, nothing we're timing
+                return;
+            }
+
+            size_t end = match();
+            if (end == std::string::npos) {
+                // Keep only enough of the tail to match a marker split across reads
+                size_t keep = std::max(marker.size(), other_marker.size());
+                if (inbox.size() > keep) inbox.erase(0, inbox.size() - keep);
+                return;
+            }
+
+            steady::time_point now = steady::now();
+            waiting = false;
+            inbox.clear();
+            if (sent_at >= measure_from) {
+                stats.latency[kind].push_back(micros(now - sent_at));
+                stats.echoed++;
+            }
+            timer.cancel();
+            schedule();
+        }
+
+        size_t match() {
+            size_t i = inbox.find(marker);
+            if (i != std::string::npos) return i + marker.size();
+            if (!other_marker.empty()) {
+                i = inbox.find(other_marker);
+                if (i != std::string::npos) return i + other_marker.size();
+            }
+            return std::string::npos;
+        }
+
+        // Wait until the next command is due (Poisson arrivals at the rate asked for, but never two outstanding)
+        void schedule() {
+            if (counters.stopping) return;
+
+            std::exponential_distribution<double> gap(opt.rate);
+            next_send += std::chrono::duration_cast<steady::duration>(std::chrono::duration<double>(gap(rng)));
+            if (next_send < steady::now()) next_send = steady::now();   // Running behind, don't try to catch up in a burst
+
+            std::shared_ptr<client> self = shared_from_this();
+            timer.expires_at(next_send);
+            timer.async_wait([this, self] (error_code error) {
+                if (!error) send_command();
+            });
+        }
+
+        void send_command() {
+            if (counters.stopping || !socket.is_open()) return;
+
+            kind = pick_kind();
+            std::string token = "#" + std::to_string(id) + "." + std::to_string(++seq) + "#";   // Nobody else's command has this in it
+            std::string line;
+            other_marker.clear();
+
+            switch (kind) {
+                case SAY:
+                    line   = "say " + token;
+                    marker = "You say:  " + token;
+                    break;
+                case SHOUT:
+                    line   = "shout " + token;
+                    marker = "You shout:  " + token;
+                    break;
+                case TELL: {
+                    std::uniform_int_distribution<uint> who(0, opt.clients - 1);
+                    std::string target = opt.prefix + std::to_string(who(rng));
+                    line         = "tell " + target + " " + token;
+                    marker       = ":  " + token;
+                    other_marker = "Player " + target + " is not connected.";
+                    break;
+                }
+                case LOOK:
+                    line   = "look";
+                    marker = "You are in:  ";
+                    break;
+                case MOVE: {
+                    static const char* directions[] = {"n", "s", "e", "w"};
+                    std::uniform_int_distribution<uint> dir(0, 3);
+                    line         = directions[dir(rng)];
+                    marker       = "You have entered ";
+                    other_marker = "You can't go that way";
+                    break;
+                }
+                default:
+                    break;
+            }
+
+            inbox.clear();
+            waiting = true;
+            sent_at = steady::now();
+            if (sent_at >= measure_from) stats.sent++;
+            write(line + "\r\n");
+
+            // Give up on the echo after a while, and carry on
+            std::shared_ptr<client> self = shared_from_this();
+            timer.expires_after(std::chrono::duration_cast<steady::duration>(std::chrono::duration<double>(opt.timeout)));
+            timer.async_wait([this, self] (error_code error) {
+                if (error || !waiting) return;
+                waiting = false;
+                if (sent_at >= measure_from) stats.timeouts++;
+                schedule();
+            });
+        }
+
+        command_kind pick_kind() {
+            uint total = 0;
+            for (uint w : opt.weights) total += w;
+            std::uniform_int_distribution<uint> pick(0, total - 1);
+            uint p = pick(rng);
+            for (int k = 0; k < NUM_KINDS; k++) {
+                if (p < opt.weights[k]) return (command_kind) k;
+                p -= opt.weights[k];
+            }
+            return SAY;
+        }
+
+        static uint32_t micros(steady::duration d) {
+            return std::chrono::duration_cast<std::chrono::microseconds>(d).count();
+        }
+};
+
+void usage() {
+    std::cout << "Usage:  loadgen [options]\n"
+                 "  --host <address>     Server address (127.0.0.1)\n"
+                 "  --port <port>        Server port (15001)\n"
+                 "  --clients <n>        Connections to open (100)\n"
+                 "  --rate <n>           Commands a second per client (1)\n"
+                 "  --ramp <seconds>     Time to spread the connections over, not measured (5)\n"
+                 "  --duration <seconds> Time to measure for after the ramp (30)\n"
+                 "  --timeout <seconds>  Time to wait for an echo (10)\n"
+                 "  --threads <n>        I/O threads (2)\n"
+                 "  --prefix <name>      Clients log in as <prefix><number> (lg)\n"
+                 "  --mix say:40,shout:5,tell:10,look:25,move:20\n"
+                 "                       Relative weights of the commands sent" << std::endl;
+}
+
+bool parse_mix(const std::string& mix, options& opt) {
+    uint weights[NUM_KINDS] = {};
+    size_t pos = 0;
+
+    while (pos < mix.size()) {
+        size_t comma = mix.find(',', pos);
+        if (comma == std::string::npos) comma = mix.size();
+        std::string item = mix.substr(pos, comma - pos);
+        pos = comma + 1;
+
+        size_t colon = item.find(':');
+        if (colon == std::string::npos) return false;
+
+        int k = 0;
+        while ((k < NUM_KINDS) && (item.compare(0, colon, kind_names[k]) != 0)) k++;
+        if (k == NUM_KINDS) return false;
+        weights[k] = std::stoul(item.substr(colon + 1));
+    }
+
+    uint total = 0;
+    for (uint w : weights) total += w;
+    if (total == 0) return false;
+
+    std::copy(weights, weights + NUM_KINDS, opt.weights);
+    return true;
+}
+
+// Print count and percentiles (in ms) of a set of latencies
+void print_latencies(const std::string& label, std::vector<uint32_t>& v) {
+    std::cout << std::left << std::setw(10) << label << std::right << std::setw(10) << v.size();
+    if (v.empty()) {
+        std::cout << std::endl;
+        return;
+    }
+
+    std::sort(v.begin(), v.end());
+    double percentiles[] = {0.50, 0.99, 0.999};
+    for (double p : percentiles) {
+        size_t i = std::min(v.size() - 1, (size_t) (p * v.size()));
+        std::cout << std::setw(10) << std::fixed << std::setprecision(2) << v[i] / 1000.0;
+    }
+    std::cout << std::setw(10) << v.back() / 1000.0 << std::endl;
+}
+
+int main(int argc, char* argv[]) {
+    options opt;
+
+    try {
+        for (int i = 1; i < argc; i++) {
+            std::string arg = argv[i];
+            if ((arg == "--help") || (arg == "-h")) {
+                usage();
+                return 0;
+            }
+            if (i + 1 >= argc) {
+                usage();
+                return 2;
+            }
+
+            std::string value = argv[++i];
+            if      (arg == "--host")     opt.host     = value;
+            else if (arg == "--port")     opt.port     = std::stoul(value);
+            else if (arg == "--clients")  opt.clients  = std::stoul(value);
+            else if (arg == "--rate")     opt.rate     = std::stod(value);
+            else if (arg == "--ramp")     opt.ramp     = std::stod(value);
+            else if (arg == "--duration") opt.duration = std::stod(value);
+            else if (arg == "--timeout")  opt.timeout  = std::stod(value);
+            else if (arg == "--threads")  opt.threads  = std::stoul(value);
+            else if (arg == "--prefix")   opt.prefix   = value;
+            else if (arg == "--mix") {
+                if (!parse_mix(value, opt)) {
+                    std::cout << "loadgen:  bad mix " << value << std::endl;
+                    return 2;
+                }
+            }
+            else {
+                usage();
+                return 2;
+            }
+        }
+    }
+    catch (const std::exception&) {
+        usage();
+        return 2;
+    }
+
+    if ((opt.clients == 0) || (opt.rate <= 0) || (opt.threads == 0)) {
+        usage();
+        return 2;
+    }
+
+    // Every client needs a file descriptor
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+        if (limit.rlim_cur < opt.clients + 64) {
+            std::cout << "loadgen:  warning - only " << limit.rlim_cur << " file descriptors allowed" << std::endl;
+        }
+    }
+
+    io::io_context io_context;
+    load_counters  counters;
+    tcp::endpoint  endpoint(io::ip::make_address(opt.host), opt.port);
+
+    steady::time_point start        = steady::now();
+    steady::time_point measure_from = start + std::chrono::duration_cast<steady::duration>(std::chrono::duration<double>(opt.ramp));
+    steady::time_point end          = measure_from + std::chrono::duration_cast<steady::duration>(std::chrono::duration<double>(opt.duration));
+
+    // Spread the connections evenly over the ramp, so the server's accept backlog doesn't overflow
+    std::vector<std::shared_ptr<client>> clients;
+    std::vector<std::unique_ptr<io::steady_timer>> starts;
+    for (uint i = 0; i < opt.clients; i++) {
+        std::shared_ptr<client> c = std::make_shared<client>(io_context, opt, counters, i, measure_from);
+        clients.push_back(c);
+
+        starts.emplace_back(new io::steady_timer(io_context));
+        starts.back()->expires_at(start + (measure_from - start) * i / opt.clients);
+        starts.back()->async_wait([c, endpoint] (error_code error) {
+            if (!error) c->start(endpoint);
+        });
+    }
+
+    std::cout << "loadgen:  " << opt.clients << " clients to " << opt.host << ":" << opt.port << " at " << opt.rate << " commands/s each, "
+              << opt.ramp << " s ramp, " << opt.duration << " s measured" << std::endl;
+
+    std::vector<std::thread> threads;
+    for (uint i = 0; i < opt.threads; i++) {
+        threads.emplace_back([&io_context] { io_context.run(); });
+    }
+
+    std::this_thread::sleep_until(measure_from);
+    std::cout << "loadgen:  " << counters.logged_in << " of " << opt.clients << " logged in after the ramp" << std::endl;
+    std::this_thread::sleep_until(end);
+
+    counters.stopping = true;
+    for (std::shared_ptr<client>& c : clients) {
+        c->stop();
+    }
+    for (std::thread& t : threads) {
+        t.join();
+    }
+
+    // Everything's stopped, so the per-client stats can be read now
+    client_stats total;
+    std::vector<uint32_t> all;
+    for (std::shared_ptr<client>& c : clients) {
+        for (int k = 0; k < NUM_KINDS; k++) {
+            total.latency[k].insert(total.latency[k].end(), c->stats.latency[k].begin(), c->stats.latency[k].end());
+        }
+        total.login_latency.insert(total.login_latency.end(), c->stats.login_latency.begin(), c->stats.login_latency.end());
+        total.sent     += c->stats.sent;
+        total.echoed   += c->stats.echoed;
+        total.timeouts += c->stats.timeouts;
+    }
+    for (int k = 0; k < NUM_KINDS; k++) {
+        all.insert(all.end(), total.latency[k].begin(), total.latency[k].end());
+    }
+
+    std::cout << std::endl;
+    std::cout << "connections:  " << counters.connected << " connected, " << counters.logged_in << " logged in, "
+              << counters.connect_failures << " connect failures, " << counters.login_failures << " login failures, "
+              << counters.disconnects << " disconnects" << std::endl;
+    std::cout << "commands:     " << total.sent << " sent, " << total.echoed << " echoed, " << total.timeouts << " timed out, "
+              << std::fixed << std::setprecision(1) << total.echoed / opt.duration << " commands/s (asked for "
+              << opt.rate * opt.clients << ")" << std::endl;
+    std::cout << "received:     " << std::setprecision(1) << counters.bytes_received / 1048576.0 << " MB" << std::endl;
+    std::cout << std::endl;
+
+    std::cout << std::left << std::setw(10) << "latency" << std::right << std::setw(10) << "count" << std::setw(10) << "p50"
+              << std::setw(10) << "p99" << std::setw(10) << "p999" << std::setw(10) << "max" << "   (ms)" << std::endl;
+    for (int k = 0; k < NUM_KINDS; k++) {
+        print_latencies(kind_names[k], total.latency[k]);
+    }
+    print_latencies("all", all);
+    print_latencies("login", total.login_latency);
+
+    return (counters.disconnects > 0) ? 1 : 0;
+}